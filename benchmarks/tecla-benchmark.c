@@ -0,0 +1,374 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <gio/gunixoutputstream.h>
+#include <gtk/gtk.h>
+
+#include "tecla-key.h"
+#include "tecla-model.h"
+#include "tecla-util.h"
+#include "tecla-view.h"
+
+#define N_MODEL_ITERATIONS 10
+#define N_LABEL_ITERATIONS 1000
+#define N_VIEW_ITERATIONS 100
+#define N_SNAPSHOT_ITERATIONS 1000
+
+#define KEY_SIZE 48
+#define MAX_LEVELS 8
+
+/* Kept fixed, so results are comparable between releases */
+static const gchar *benchmark_layouts[] = {
+	"us",
+	"us+dvorak",
+	"de",
+	"fr",
+	"cz",
+	"ru",
+	"ara",
+	"jp",
+};
+
+typedef struct
+{
+	gint64 total;
+	gint64 min;
+	gint64 max;
+	guint n_iterations;
+	guint64 n_ops;
+} BenchmarkResult;
+
+typedef void (* BenchmarkFunc) (gpointer user_data);
+
+static void
+run_benchmark (BenchmarkResult *result,
+	       guint            n_iterations,
+	       guint64          ops_per_iteration,
+	       BenchmarkFunc    func,
+	       gpointer         user_data)
+{
+	guint i;
+
+	result->total = 0;
+	result->min = G_MAXINT64;
+	result->max = 0;
+	result->n_iterations = n_iterations;
+	result->n_ops = ops_per_iteration * n_iterations;
+
+	for (i = 0; i < n_iterations; i++) {
+		gint64 start, elapsed;
+
+		start = g_get_monotonic_time ();
+		func (user_data);
+		elapsed = g_get_monotonic_time () - start;
+
+		result->total += elapsed;
+		result->min = MIN (result->min, elapsed);
+		result->max = MAX (result->max, elapsed);
+	}
+}
+
+static void
+append_result (GString               *json,
+	       const gchar           *name,
+	       const gchar           *layout,
+	       const BenchmarkResult *result)
+{
+	if (json->str[json->len - 1] != '[')
+		g_string_append_c (json, ',');
+
+	g_string_append_printf (json, "\n{\"name\":\"%s\"", name);
+
+	if (layout)
+		g_string_append_printf (json, ",\"layout\":\"%s\"", layout);
+
+	if (!result) {
+		g_string_append (json, ",\"skipped\":true}");
+		return;
+	}
+
+	g_string_append_printf (json,
+				",\"iterations\":%u,\"mean_us\":%.3f"
+				",\"min_us\":%" G_GINT64_FORMAT
+				",\"max_us\":%" G_GINT64_FORMAT,
+				result->n_iterations,
+				(double) result->total / result->n_iterations,
+				result->min, result->max);
+
+	if (result->n_ops > result->n_iterations && result->total > 0) {
+		g_string_append_printf (json, ",\"ops_per_sec\":%.0f",
+					result->n_ops * (double) G_USEC_PER_SEC /
+					result->total);
+	}
+
+	g_string_append_c (json, '}');
+}
+
+typedef struct
+{
+	struct xkb_context *xkb_context;
+	const gchar *layout;
+} ModelBuildData;
+
+static void
+build_model (ModelBuildData *data)
+{
+	g_autoptr (TeclaModel) model = NULL;
+	g_autofree gchar *layout = NULL;
+	struct xkb_keymap *xkb_keymap;
+	struct xkb_rule_names rule_names = {
+		.rules = "evdev",
+		.model = "pc105",
+	};
+	gchar *variant;
+
+	layout = g_strdup (data->layout);
+	variant = strchr (layout, '+');
+	if (variant)
+		*variant++ = '\0';
+
+	/* The uncached path of tecla_model_new_from_layout_name() */
+	rule_names.layout = layout;
+	rule_names.variant = variant;
+	xkb_keymap = xkb_keymap_new_from_names (data->xkb_context,
+						&rule_names, 0);
+	if (!xkb_keymap)
+		return;
+
+	model = tecla_model_new_from_xkb_keymap (xkb_keymap);
+	xkb_keymap_unref (xkb_keymap);
+}
+
+static void
+benchmark_models (GString *json)
+{
+	ModelBuildData data;
+	gsize i;
+
+	data.xkb_context = tecla_util_create_xkb_context ();
+
+	for (i = 0; i < G_N_ELEMENTS (benchmark_layouts); i++) {
+		g_autoptr (TeclaModel) model = NULL;
+		BenchmarkResult result;
+		gint64 start;
+
+		data.layout = benchmark_layouts[i];
+		run_benchmark (&result, N_MODEL_ITERATIONS, 1,
+			       (BenchmarkFunc) build_model, &data);
+		append_result (json, "model-build", data.layout, &result);
+
+		/* Loading from the model cache is only measurable once
+		 * per process, later calls share the loaded model.
+		 */
+		start = g_get_monotonic_time ();
+		model = tecla_model_new_from_layout_name (data.layout);
+		result.total = result.min = result.max =
+			g_get_monotonic_time () - start;
+		result.n_iterations = result.n_ops = 1;
+		append_result (json, "model-new-from-layout-name", data.layout,
+			       model ? &result : NULL);
+	}
+
+	xkb_context_unref (data.xkb_context);
+}
+
+static void
+get_all_labels (TeclaModel *model)
+{
+	xkb_keycode_t keycode;
+	int level;
+
+	for (keycode = 0; keycode <= G_MAXUINT8; keycode++) {
+		const gchar *key;
+
+		key = tecla_model_get_keycode_key (model, keycode);
+		if (!key)
+			continue;
+
+		for (level = 0; level < MAX_LEVELS; level++)
+			tecla_model_get_key_label (model, level, key);
+	}
+}
+
+static void
+benchmark_labels (GString    *json,
+		  TeclaModel *model)
+{
+	BenchmarkResult result;
+
+	run_benchmark (&result, N_LABEL_ITERATIONS,
+		       (G_MAXUINT8 + 1) * MAX_LEVELS,
+		       (BenchmarkFunc) get_all_labels, model);
+	append_result (json, "key-labels", tecla_model_get_name (model), &result);
+}
+
+typedef struct
+{
+	TeclaView *view;
+	TeclaModel *model;
+} ViewUpdateData;
+
+static void
+update_all_levels (ViewUpdateData *data)
+{
+	int level, n_levels;
+
+	/* Emits TeclaModel::changed, which updates every key */
+	tecla_model_set_group (data->model, 0);
+
+	n_levels = tecla_view_get_num_levels (data->view);
+	for (level = 0; level < n_levels; level++)
+		tecla_view_set_current_level (data->view, level);
+}
+
+static void
+benchmark_view (GString    *json,
+		TeclaModel *model)
+{
+	ViewUpdateData data;
+	BenchmarkResult result;
+
+	data.model = model;
+	data.view = TECLA_VIEW (g_object_ref_sink (tecla_view_new ()));
+	tecla_view_set_model (data.view, model);
+
+	run_benchmark (&result, N_VIEW_ITERATIONS, 1,
+		       (BenchmarkFunc) update_all_levels, &data);
+	append_result (json, "view-update", tecla_model_get_name (model), &result);
+
+	g_object_unref (data.view);
+}
+
+typedef struct
+{
+	GtkWidget *key;
+	GskRenderer *renderer;
+} SnapshotData;
+
+static void
+render_key (SnapshotData *data)
+{
+	g_autoptr (GdkTexture) texture = NULL;
+	GskRenderNode *node;
+	GtkSnapshot *snapshot;
+
+	snapshot = gtk_snapshot_new ();
+	GTK_WIDGET_GET_CLASS (data->key)->snapshot (data->key, snapshot);
+	node = gtk_snapshot_free_to_node (snapshot);
+	if (!node)
+		return;
+
+	texture = gsk_renderer_render_texture (data->renderer, node,
+					       &GRAPHENE_RECT_INIT (0, 0,
+								    KEY_SIZE,
+								    KEY_SIZE));
+	gsk_render_node_unref (node);
+}
+
+static gboolean
+benchmark_snapshot (GString  *json,
+		    GError  **error)
+{
+	SnapshotData data;
+	BenchmarkResult result;
+
+	data.renderer = gsk_cairo_renderer_new ();
+	if (!gsk_renderer_realize (data.renderer, NULL, error)) {
+		g_object_unref (data.renderer);
+		return FALSE;
+	}
+
+	data.key = g_object_ref_sink (tecla_key_new ("AC01"));
+	tecla_key_set_label (TECLA_KEY (data.key), "A");
+	gtk_widget_measure (data.key, GTK_ORIENTATION_HORIZONTAL, -1,
+			    NULL, NULL, NULL, NULL);
+	gtk_widget_allocate (data.key, KEY_SIZE, KEY_SIZE, -1, NULL);
+
+	run_benchmark (&result, N_SNAPSHOT_ITERATIONS, 1,
+		       (BenchmarkFunc) render_key, &data);
+	append_result (json, "key-snapshot", NULL, &result);
+
+	gsk_renderer_unrealize (data.renderer);
+	g_object_unref (data.renderer);
+	g_object_unref (data.key);
+
+	return TRUE;
+}
+
+static gboolean
+run_benchmarks (GOutputStream  *stream,
+		GError        **error)
+{
+	g_autoptr (GString) json = NULL;
+	g_autoptr (TeclaModel) model = NULL;
+
+	json = g_string_new (NULL);
+	g_string_append_printf (json, "{\"version\":\"%s\",\"benchmarks\":[",
+				PACKAGE_VERSION);
+
+	benchmark_models (json);
+
+	model = tecla_model_new_from_layout_name (benchmark_layouts[0]);
+	if (!model) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+			     "Could not load layout “%s”", benchmark_layouts[0]);
+		return FALSE;
+	}
+
+	benchmark_labels (json, model);
+
+	/* Widget benchmarks need a display */
+	if (gtk_init_check ()) {
+		benchmark_view (json, model);
+
+		if (!benchmark_snapshot (json, error))
+			return FALSE;
+	} else {
+		append_result (json, "view-update", NULL, NULL);
+		append_result (json, "key-snapshot", NULL, NULL);
+	}
+
+	g_string_append (json, "\n]}\n");
+
+	return g_output_stream_write_all (stream, json->str, json->len,
+					  NULL, NULL, error);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+	g_autoptr (GOutputStream) stdout_stream = NULL;
+	g_autoptr (GError) error = NULL;
+
+	/* Results are printed as JSON, for meson benchmark to collect */
+	stdout_stream = g_unix_output_stream_new (STDOUT_FILENO, FALSE);
+
+	if (!run_benchmarks (stdout_stream, &error)) {
+		g_printerr ("%s\n", error->message);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,51 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "tecla-model-private.h"
+
+/* Levels rarely emit more than a couple of keysyms */
+#define MAX_KEYSYMS 8
+
+/* Input is read as native endian keysyms, covering the whole 32 bit
+ * range rather than only the keysyms that layouts use.
+ */
+int
+LLVMFuzzerTestOneInput (const uint8_t *data,
+			size_t         size)
+{
+	xkb_keysym_t keysyms[MAX_KEYSYMS];
+	g_autofree gchar *label = NULL;
+	int n_keysyms;
+
+	n_keysyms = MIN (size / sizeof (xkb_keysym_t), MAX_KEYSYMS);
+	if (n_keysyms == 0)
+		return 0;
+
+	memcpy (keysyms, data, n_keysyms * sizeof (xkb_keysym_t));
+	label = tecla_model_get_keysyms_label (keysyms, n_keysyms);
+	g_assert (g_utf8_validate (label, -1, NULL));
+
+	return 0;
+}
@@ -0,0 +1,50 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include "tecla-keymap-observer.h"
+#include "tecla-model.h"
+
+/* Input is the keymap text as sent through wl_keyboard.keymap */
+int
+LLVMFuzzerTestOneInput (const uint8_t *data,
+			size_t         size)
+{
+	g_autoptr (GBytes) keymap_data = NULL;
+	g_autoptr (TeclaModel) model = NULL;
+	struct xkb_keymap *xkb_keymap;
+
+	keymap_data = tecla_keymap_observer_read_keymap ((const gchar *) data,
+							 size);
+	if (!keymap_data)
+		return 0;
+
+	xkb_keymap = tecla_keymap_observer_compile_keymap (keymap_data);
+	if (!xkb_keymap)
+		return 0;
+
+	model = tecla_model_new_from_xkb_keymap (xkb_keymap);
+	xkb_keymap_unref (xkb_keymap);
+
+	return 0;
+}
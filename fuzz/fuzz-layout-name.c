@@ -0,0 +1,46 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "tecla-model-private.h"
+
+/* Same parsing as tecla_model_new_from_layout_name(), without the
+ * model cache so runs are reproducible.
+ */
+int
+LLVMFuzzerTestOneInput (const uint8_t *data,
+			size_t         size)
+{
+	g_autofree gchar *name = NULL;
+	g_autoptr (TeclaModel) model = NULL;
+
+	/* Layout names come from the command line and settings */
+	name = g_strndup ((const gchar *) data, size);
+	if (strlen (name) != size || !g_utf8_validate (name, -1, NULL))
+		return 0;
+
+	model = tecla_model_compile_layout_name (name);
+
+	return 0;
+}
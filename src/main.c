@@ -20,17 +20,45 @@
 
 #include "config.h"
 
-#include <libadwaita-1/adwaita.h>
 #include <locale.h>
 #include <glib/gi18n.h>
 
 #include "tecla-application.h"
+#include "tecla-model-private.h"
+#include "tecla-startup.h"
+#include "tecla-stats.h"
+
+static void
+model_event_cb (TeclaModelEvent event)
+{
+	switch (event) {
+	case TECLA_MODEL_EVENT_COMPILE_BEGIN:
+		tecla_startup_begin (TECLA_STARTUP_MODEL_COMPILE);
+		break;
+	case TECLA_MODEL_EVENT_COMPILE_END:
+		tecla_startup_end (TECLA_STARTUP_MODEL_COMPILE);
+		break;
+	case TECLA_MODEL_EVENT_SHARED_HIT:
+		tecla_stats_increment (TECLA_STATS_MODEL_SHARED_HITS);
+		break;
+	case TECLA_MODEL_EVENT_CACHE_HIT:
+		tecla_stats_increment (TECLA_STATS_MODEL_CACHE_HITS);
+		break;
+	case TECLA_MODEL_EVENT_CACHE_MISS:
+		tecla_stats_increment (TECLA_STATS_MODEL_CACHE_MISSES);
+		break;
+	}
+}
 
 int
 main (int   argc,
       char *argv[])
 {
 	GApplication *app;
+	int status;
+
+	tecla_startup_mark (TECLA_STARTUP_MAIN, g_get_monotonic_time ());
+	tecla_model_set_event_func (model_event_cb);
 
 	bindtextdomain (GETTEXT_PACKAGE, LOCALEDIR);
 	bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
@@ -38,7 +66,9 @@ main (int   argc,
 
 	setlocale (LC_ALL, "");
 
-	adw_init ();
 	app = tecla_application_new ();
-	g_application_run (app, argc, argv);
+	status = g_application_run (app, argc, argv);
+	g_object_unref (app);
+
+	return status;
 }
@@ -21,22 +21,43 @@
 #include "config.h"
 #include "tecla-application.h"
 
+#include "tecla-compose.h"
+#include "tecla-coverage.h"
+#include "tecla-export.h"
+#include "tecla-gallery.h"
 #include "tecla-key.h"
 #include "tecla-keymap-observer.h"
+#include "tecla-latency.h"
 #include "tecla-model.h"
+#include "tecla-profiler.h"
+#include "tecla-registry.h"
+#include "tecla-render.h"
+#include "tecla-replay.h"
+#include "tecla-startup.h"
+#include "tecla-stats.h"
+#include "tecla-thumbnail.h"
 #include "tecla-view.h"
 
+#include <libadwaita-1/adwaita.h>
+#include <gio/gunixfdlist.h>
+#include <gio/gunixoutputstream.h>
 #include <glib/gi18n.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #ifdef GDK_WINDOWING_WAYLAND
 #include <gdk/wayland/gdkwayland.h>
 #endif
 
+/* Exit status for skipped tests, as understood by meson */
+#define EXIT_SKIP 77
+
 typedef struct
 {
 	int level;
 	guint keyval;
+	const xkb_keysym_t *keysyms;
+	int n_keysyms;
 } KeyInfo;
 
 typedef struct
@@ -44,6 +65,7 @@ typedef struct
 	GtkWindow *window;
 	TeclaView *view;
 	TeclaModel *model;
+	gchar *parent_handle;
 	gulong remove_handler_id;
 } TeclaInstance;
 
@@ -55,26 +77,88 @@ struct _TeclaApplication
 	GList *instances; /* TeclaInstance* */
 	gchar *layout;
 	gchar *parent_handle;
+	guint preview_id;
+	guint debug_id;
+
+	/* Prebuilt window, to be used by the next activation */
+	GtkWindow *spare_window;
+	TeclaView *spare_view;
+	guint spare_window_id;
+	gboolean resident;
+
+	GtkWindow *gallery_window;
+	gboolean show_gallery;
+
+	TeclaLatencyProbe *latency_probe;
+	TeclaKeyRecorder *key_recorder;
+
+	gboolean benchmark_startup;
+	gint64 startup_frame;
 };
 
 static GtkPopover *current_popover = NULL;
 
 G_DEFINE_TYPE (TeclaApplication, tecla_application, GTK_TYPE_APPLICATION)
 
+static void present_gallery (TeclaApplication *app);
+
 static int
 tecla_application_command_line (GApplication            *app,
 				GApplicationCommandLine *cl)
 {
 	TeclaApplication *tecla_app = TECLA_APPLICATION (app);
 	GVariantDict *options;
-	g_autofree GStrv argv = NULL;
-	int argc;
+	g_autofree const gchar **layouts = NULL;
+	const gchar *record_path;
+	int idle_timeout;
 
 	options = g_application_command_line_get_options_dict (cl);
-	argv = g_application_command_line_get_arguments (cl, &argc);
 
-	if (argc > 1) {
-		g_set_str (&tecla_app->layout, argv[1]);
+	if (g_variant_dict_lookup (options, "idle-timeout", "i", &idle_timeout)) {
+		/* Keep the value in milliseconds from overflowing */
+		idle_timeout = CLAMP (idle_timeout, 0, G_MAXINT / 1000);
+		g_application_set_inactivity_timeout (app, idle_timeout * 1000);
+		tecla_app->resident = idle_timeout > 0;
+	}
+
+	if (g_variant_dict_contains (options, "benchmark-startup"))
+		tecla_app->benchmark_startup = TRUE;
+
+	if (g_variant_dict_contains (options, "measure-latency") &&
+	    !tecla_app->latency_probe)
+		tecla_app->latency_probe = tecla_latency_probe_new ();
+
+	if (g_variant_dict_lookup (options, "record", "^&ay", &record_path) &&
+	    !tecla_app->key_recorder) {
+		g_autoptr (GFile) file = NULL;
+		g_autoptr (GError) error = NULL;
+
+		file = g_application_command_line_create_file_for_arg (cl, record_path);
+		tecla_app->key_recorder = tecla_key_recorder_new (file, &error);
+		if (!tecla_app->key_recorder) {
+			g_application_command_line_printerr (cl, "%s\n", error->message);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (g_variant_dict_contains (options, "gallery")) {
+		tecla_app->show_gallery = TRUE;
+	} else if (g_variant_dict_lookup (options, G_OPTION_REMAINING, "^a&s", &layouts) &&
+		   layouts[0]) {
+		g_autoptr (TeclaModel) model = NULL;
+
+		/* Layouts missing from the registry may still exist in XKB */
+		if (!tecla_registry_lookup (tecla_registry_get_default (), layouts[0]) &&
+		    !(model = tecla_model_new_from_layout_name (layouts[0]))) {
+			g_autofree gchar *message = NULL;
+
+			message = tecla_registry_format_suggestions (tecla_registry_get_default (),
+								     layouts[0]);
+			g_application_command_line_printerr (cl, "%s\n", message);
+			return EXIT_FAILURE;
+		}
+
+		g_set_str (&tecla_app->layout, layouts[0]);
 		g_set_str (&tecla_app->parent_handle, NULL);
 		g_variant_dict_lookup (options, "parent-handle", "s", &tecla_app->parent_handle);
 	}
@@ -87,19 +171,380 @@ tecla_application_command_line (GApplication            *app,
 const GOptionEntry all_options[] = {
 	{ "parent-handle", 0, 0, G_OPTION_ARG_STRING, NULL, N_("Attach to a parent window"), N_("Window handle") },
 	{ "version", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Display version number"), NULL },
+	{ "export-all", 0, 0, G_OPTION_ARG_FILENAME, NULL, N_("Export all installed layouts to a directory"), N_("Directory") },
+	{ "check-all", 0, 0, G_OPTION_ARG_FILENAME, NULL, N_("Compare layouts against the exported files in a directory"), N_("Directory") },
+	{ "shard", 0, 0, G_OPTION_ARG_STRING, NULL, N_("Only export or check one part of the layouts"), N_("Index/Count") },
+	{ "render-references", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, NULL, N_("Render the keyboard view to reference images in a directory"), N_("Directory") },
+	{ "render-check", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, NULL, N_("Compare renders of the keyboard view against reference images"), N_("Directory") },
+	{ "time-budget", 0, 0, G_OPTION_ARG_INT, NULL, N_("Fail checks of layouts taking longer to compile or label"), N_("Milliseconds") },
+	{ "idle-timeout", 0, 0, G_OPTION_ARG_INT, NULL, N_("Keep running in the background after the last window is closed"), N_("Seconds") },
+	{ "dump", 0, 0, G_OPTION_ARG_STRING, NULL, N_("Print the layout keymap in the given format (json, tsv)"), N_("Format") },
+	{ "gallery", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Browse all installed layouts"), NULL },
+	{ "which", 0, 0, G_OPTION_ARG_STRING, NULL, N_("List the layouts able to type the given characters"), N_("Characters") },
+	{ "measure-latency", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Measure key press to frame latency, reported on exit"), NULL },
+	{ "benchmark-startup", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Print a breakdown of startup time and exit after the first frame"), NULL },
+	{ "record", 0, 0, G_OPTION_ARG_FILENAME, NULL, N_("Record key events received by the keyboard view to a file"), N_("File") },
+	{ "replay", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, NULL, N_("Replay recorded key events without showing a window"), N_("File") },
+	{ "replay-speed", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, NULL, N_("Replay speed (original, max)"), N_("Speed") },
+	{ "stats", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Print performance counters of the running instance"), NULL },
+	{ G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, NULL, NULL, N_("[LAYOUT]") },
 	{ NULL, 0, 0, 0, NULL, NULL, NULL } /* end the list */
 };
 
+static gboolean
+get_shard (GVariantDict  *options,
+	   guint         *shard,
+	   guint         *n_shards,
+	   GError       **error)
+{
+	g_auto (GStrv) parts = NULL;
+	const gchar *str;
+	guint64 index, count;
+
+	*shard = 0;
+	*n_shards = 1;
+
+	if (!g_variant_dict_lookup (options, "shard", "&s", &str))
+		return TRUE;
+
+	/* Shards are numbered from 1, as in "2/4" */
+	parts = g_strsplit (str, "/", 2);
+	if (g_strv_length (parts) != 2) {
+		g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+			     "Invalid shard “%s”, expected Index/Count", str);
+		return FALSE;
+	}
+
+	if (!g_ascii_string_to_unsigned (parts[1], 10, 1, G_MAXUINT,
+					 &count, error) ||
+	    !g_ascii_string_to_unsigned (parts[0], 10, 1, count,
+					 &index, error))
+		return FALSE;
+
+	*shard = index - 1;
+	*n_shards = count;
+
+	return TRUE;
+}
+
+static gboolean
+dump_layout (const gchar  *layout,
+	     const gchar  *format_str,
+	     GError      **error)
+{
+	g_autoptr (TeclaModel) model = NULL;
+	g_autoptr (GOutputStream) stdout_stream = NULL;
+	g_autoptr (GOutputStream) stream = NULL;
+	TeclaModelFormat format;
+
+	if (g_strcmp0 (format_str, "json") == 0) {
+		format = TECLA_MODEL_FORMAT_JSON;
+	} else if (g_strcmp0 (format_str, "tsv") == 0) {
+		format = TECLA_MODEL_FORMAT_TSV;
+	} else {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+			     _("Unknown format “%s”"), format_str);
+		return FALSE;
+	}
+
+	if (!layout) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+				     _("No layout given"));
+		return FALSE;
+	}
+
+	model = tecla_model_new_from_layout_name (layout);
+	if (!model) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+			     _("Could not load layout “%s”"), layout);
+		return FALSE;
+	}
+
+	stdout_stream = g_unix_output_stream_new (STDOUT_FILENO, FALSE);
+	stream = g_buffered_output_stream_new (stdout_stream);
+
+	if (!tecla_model_serialize (model, format, stream, error))
+		return FALSE;
+
+	return g_output_stream_close (stream, NULL, error);
+}
+
+static gboolean
+print_coverage (const gchar  *chars,
+		GError      **error)
+{
+	g_autoptr (TeclaCoverage) coverage = NULL;
+	g_autoptr (GArray) codepoints = NULL;
+	const gchar *p;
+	guint i, j;
+
+	codepoints = g_array_new (FALSE, FALSE, sizeof (gunichar));
+
+	if (g_ascii_strncasecmp (chars, "U+", 2) == 0) {
+		gunichar ch;
+		gchar *end;
+
+		ch = g_ascii_strtoull (chars + 2, &end, 16);
+		if (end == chars + 2 || *end || !g_unichar_validate (ch)) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+				     _("Invalid code point “%s”"), chars);
+			return FALSE;
+		}
+
+		g_array_append_val (codepoints, ch);
+	} else if (g_utf8_validate (chars, -1, NULL)) {
+		for (p = chars; *p; p = g_utf8_next_char (p)) {
+			gunichar ch = g_utf8_get_char (p);
+
+			g_array_append_val (codepoints, ch);
+		}
+	} else {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+				     _("Characters are not valid UTF-8"));
+		return FALSE;
+	}
+
+	coverage = tecla_coverage_new (error);
+	if (!coverage)
+		return FALSE;
+
+	for (i = 0; i < codepoints->len; i++) {
+		gunichar ch = g_array_index (codepoints, gunichar, i);
+		g_autoptr (GArray) entries = NULL;
+
+		entries = tecla_coverage_lookup (coverage, ch);
+
+		if (entries->len == 0)
+			g_printerr (_("No layout types U+%04X\n"), ch);
+
+		for (j = 0; j < entries->len; j++) {
+			TeclaCoverageEntry *entry;
+
+			entry = &g_array_index (entries, TeclaCoverageEntry, j);
+			g_print ("U+%04X\t%s\t%s\t%d\t%d\n", ch,
+				 entry->layout, entry->key,
+				 entry->group + 1, entry->level + 1);
+		}
+	}
+
+	return TRUE;
+}
+
+static gboolean
+print_stats (GApplication  *app,
+	     GError       **error)
+{
+	g_autoptr (GDBusConnection) bus = NULL;
+	g_autoptr (GVariant) reply = NULL;
+	g_autoptr (GVariant) properties = NULL;
+	g_autoptr (GVariant) counters = NULL;
+	g_autoptr (GVariant) histograms = NULL;
+	g_autofree gchar *object_path = NULL;
+	g_autoptr (GVariantIter) buckets = NULL;
+	const gchar *name;
+	GVariantIter iter;
+	guint64 value, count, sum;
+	gchar *p;
+
+	bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
+	if (!bus)
+		return FALSE;
+
+	/* Same object path GApplication exports its interfaces on */
+	object_path = g_strconcat ("/", g_application_get_application_id (app), NULL);
+	for (p = object_path; *p; p++) {
+		if (*p == '.')
+			*p = '/';
+		else if (*p == '-')
+			*p = '_';
+	}
+
+	reply = g_dbus_connection_call_sync (bus,
+					     g_application_get_application_id (app),
+					     object_path,
+					     "org.freedesktop.DBus.Properties",
+					     "GetAll",
+					     g_variant_new ("(s)", "org.gnome.Tecla.Debug"),
+					     G_VARIANT_TYPE ("(a{sv})"),
+					     G_DBUS_CALL_FLAGS_NO_AUTO_START,
+					     -1, NULL, error);
+	if (!reply)
+		return FALSE;
+
+	properties = g_variant_get_child_value (reply, 0);
+	counters = g_variant_lookup_value (properties, "Counters",
+					   G_VARIANT_TYPE ("a{st}"));
+	histograms = g_variant_lookup_value (properties, "Histograms",
+					     G_VARIANT_TYPE ("a{s(ttat)}"));
+
+	if (counters) {
+		g_variant_iter_init (&iter, counters);
+		while (g_variant_iter_next (&iter, "{&st}", &name, &value))
+			g_print ("%s\t%" G_GUINT64_FORMAT "\n", name, value);
+	}
+
+	if (histograms) {
+		g_variant_iter_init (&iter, histograms);
+		while (g_variant_iter_next (&iter, "{&s(ttat)}",
+					    &name, &count, &sum, &buckets)) {
+			g_print ("%s\t%" G_GUINT64_FORMAT "\t%.1f",
+				 name, count, count > 0 ? (double) sum / count : 0.0);
+
+			while (g_variant_iter_next (buckets, "t", &value))
+				g_print ("\t%" G_GUINT64_FORMAT, value);
+
+			g_print ("\n");
+			g_clear_pointer (&buckets, g_variant_iter_free);
+		}
+	}
+
+	return TRUE;
+}
+
 static int
 tecla_application_handle_local_options (GApplication *app,
 					GVariantDict *options)
 {
+	const gchar *export_dir, *check_dir, *render_dir, *format, *chars, *replay_path;
+	gboolean render_update;
+
 	if (g_variant_dict_contains (options, "version")) {
 		g_print ("%s %s\n", PACKAGE, VERSION);
 
 		return 0;
 	}
 
+	if (g_variant_dict_lookup (options, "export-all", "^&ay", &export_dir)) {
+		g_autoptr (GError) error = NULL;
+		guint shard, n_shards;
+
+		if (!get_shard (options, &shard, &n_shards, &error) ||
+		    !tecla_export_all_layouts (export_dir, shard, n_shards, &error)) {
+			g_printerr ("%s\n", error->message);
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	if (g_variant_dict_lookup (options, "check-all", "^&ay", &check_dir)) {
+		g_autoptr (GError) error = NULL;
+		guint shard, n_shards;
+		int budget = 0;
+
+		g_variant_dict_lookup (options, "time-budget", "i", &budget);
+
+		if (!get_shard (options, &shard, &n_shards, &error) ||
+		    !tecla_export_check_all_layouts (check_dir, shard, n_shards,
+						     (gint64) MAX (budget, 0) * 1000,
+						     &error)) {
+			g_printerr ("%s\n", error->message);
+
+			if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+				return EXIT_SKIP;
+
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	render_update = g_variant_dict_lookup (options, "render-references", "^&ay", &render_dir);
+	if (render_update ||
+	    g_variant_dict_lookup (options, "render-check", "^&ay", &render_dir)) {
+		g_autofree const gchar **layouts = NULL;
+		g_autoptr (GError) error = NULL;
+
+		g_variant_dict_lookup (options, G_OPTION_REMAINING, "^a&s", &layouts);
+
+		if (!tecla_render_check (render_dir,
+					 layouts && layouts[0] ? layouts[0] : "us",
+					 render_update, &error)) {
+			g_printerr ("%s\n", error->message);
+
+			/* Tell the test harness there is no display to render on */
+			if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_CONNECTED))
+				return EXIT_SKIP;
+
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	if (g_variant_dict_lookup (options, "which", "&s", &chars)) {
+		g_autoptr (GError) error = NULL;
+
+		if (!print_coverage (chars, &error)) {
+			g_printerr ("%s\n", error->message);
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	if (g_variant_dict_contains (options, "stats")) {
+		g_autoptr (GError) error = NULL;
+
+		if (!print_stats (app, &error)) {
+			g_printerr ("%s\n", error->message);
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	/* Startup must be measured in a fresh process, not in an
+	 * already running instance.
+	 */
+	if (g_variant_dict_contains (options, "benchmark-startup")) {
+		g_application_set_flags (app,
+					 g_application_get_flags (app) |
+					 G_APPLICATION_NON_UNIQUE);
+	}
+
+	if (g_variant_dict_lookup (options, "replay", "^&ay", &replay_path)) {
+		g_autofree const gchar **layouts = NULL;
+		g_autofree gchar *report = NULL;
+		g_autoptr (GError) error = NULL;
+		const gchar *speed = "max";
+
+		g_variant_dict_lookup (options, "replay-speed", "&s", &speed);
+		if (!g_str_equal (speed, "max") && !g_str_equal (speed, "original")) {
+			g_printerr ("Unknown replay speed “%s”\n", speed);
+			return EXIT_FAILURE;
+		}
+
+		g_variant_dict_lookup (options, G_OPTION_REMAINING, "^a&s", &layouts);
+
+		report = tecla_replay_run (replay_path,
+					   layouts && layouts[0] ? layouts[0] : "us",
+					   g_str_equal (speed, "original"),
+					   &error);
+		if (!report) {
+			g_printerr ("%s\n", error->message);
+			return EXIT_FAILURE;
+		}
+
+		g_print ("%s", report);
+
+		return EXIT_SUCCESS;
+	}
+
+	if (g_variant_dict_lookup (options, "dump", "&s", &format)) {
+		g_autofree const gchar **layouts = NULL;
+		g_autoptr (GError) error = NULL;
+
+		g_variant_dict_lookup (options, G_OPTION_REMAINING, "^a&s", &layouts);
+
+		if (!dump_layout (layouts ? layouts[0] : NULL, format, &error)) {
+			g_printerr ("%s\n", error->message);
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
 	return -1;
 }
 
@@ -172,29 +617,109 @@ update_title (GtkWindow  *window,
 	gtk_window_set_title (GTK_WINDOW (window), title);
 }
 
+static void
+find_changed_cb (GtkSearchEntry *entry,
+		 TeclaView      *view)
+{
+	const gchar *text;
+	gunichar ch = 0;
+
+	text = gtk_editable_get_text (GTK_EDITABLE (entry));
+	if (*text)
+		ch = g_utf8_get_char_validated (text, -1);
+
+	if (tecla_view_highlight_char (view, ch) || ch == 0)
+		gtk_widget_remove_css_class (GTK_WIDGET (entry), "error");
+	else
+		gtk_widget_add_css_class (GTK_WIDGET (entry), "error");
+}
+
 static GtkWindow *
-create_window (TeclaApplication  *app,
-	       TeclaView        **view_out)
+build_window (TeclaView **view_out)
 {
 	g_autoptr (GtkBuilder) builder = NULL;
 	TeclaView *view;
 	GtkWindow *window;
+	GtkWidget *find_entry, *group_dropdown;
 	GtkBox *levels;
 
 	g_type_ensure (TECLA_TYPE_VIEW);
 
+	tecla_startup_begin (TECLA_STARTUP_WINDOW_PARSE);
 	builder = gtk_builder_new ();
 	gtk_builder_add_from_resource (builder,
 				       "/org/gnome/tecla/tecla-window.ui",
 				       NULL);
+	tecla_startup_end (TECLA_STARTUP_WINDOW_PARSE);
 
 	window = GTK_WINDOW (gtk_builder_get_object (builder, "window"));
 	view = TECLA_VIEW (gtk_builder_get_object (builder, "view"));
 	levels = GTK_BOX (gtk_builder_get_object (builder, "levels"));
-	gtk_application_add_window (GTK_APPLICATION (app), window);
+	find_entry = GTK_WIDGET (gtk_builder_get_object (builder, "find_entry"));
+	group_dropdown = GTK_WIDGET (gtk_builder_get_object (builder, "group_dropdown"));
 
 	g_signal_connect (view, "notify::num-levels",
 			  G_CALLBACK (num_levels_notify_cb), levels);
+	g_signal_connect (find_entry, "search-changed",
+			  G_CALLBACK (find_changed_cb), view);
+
+	g_object_set_data (G_OBJECT (window), "group-dropdown", group_dropdown);
+
+	if (view_out)
+		*view_out = view;
+
+	return window;
+}
+
+static gboolean
+create_spare_window (TeclaApplication *app)
+{
+	app->spare_window_id = 0;
+
+	if (!app->spare_window)
+		app->spare_window = build_window (&app->spare_view);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+queue_spare_window (TeclaApplication *app)
+{
+	if (app->spare_window || app->spare_window_id)
+		return;
+
+	app->spare_window_id =
+		g_idle_add_full (G_PRIORITY_LOW,
+				 (GSourceFunc) create_spare_window,
+				 app, NULL);
+}
+
+static GtkWindow *
+create_window (TeclaApplication  *app,
+	       TeclaView        **view_out)
+{
+	GtkWindow *window;
+	TeclaView *view;
+
+	if (app->spare_window) {
+		window = g_steal_pointer (&app->spare_window);
+		view = g_steal_pointer (&app->spare_view);
+	} else {
+		window = build_window (&view);
+	}
+
+	gtk_application_add_window (GTK_APPLICATION (app), window);
+
+	if (app->latency_probe)
+		tecla_latency_probe_watch (app->latency_probe, view);
+	if (app->key_recorder)
+		tecla_key_recorder_watch (app->key_recorder, GTK_WIDGET (view));
+
+	/* Spare windows are not added to the application until used,
+	 * so they do not keep it running on their own.
+	 */
+	if (app->resident)
+		queue_spare_window (app);
 
 	if (view_out)
 		*view_out = view;
@@ -207,7 +732,48 @@ name_notify_cb (TeclaModel *model,
 		GParamSpec *pspec,
 		GtkWindow  *window)
 {
+	GtkDropDown *group_dropdown;
+
 	update_title (window, model);
+
+	group_dropdown = g_object_get_data (G_OBJECT (window), "group-dropdown");
+	gtk_drop_down_set_selected (group_dropdown,
+				    tecla_model_get_group (model));
+}
+
+static void
+group_selected_cb (GtkDropDown *group_dropdown,
+		   GParamSpec  *pspec,
+		   TeclaModel  *model)
+{
+	guint group;
+
+	group = gtk_drop_down_get_selected (group_dropdown);
+
+	if (group != GTK_INVALID_LIST_POSITION &&
+	    group != (guint) tecla_model_get_group (model))
+		tecla_model_set_group (model, group);
+}
+
+static void
+update_groups (GtkDropDown *group_dropdown,
+	       TeclaModel  *model)
+{
+	g_autoptr (GtkStringList) groups = NULL;
+	guint i, n_groups;
+
+	n_groups = tecla_model_get_n_groups (model);
+	groups = gtk_string_list_new (NULL);
+
+	for (i = 0; i < n_groups; i++) {
+		gtk_string_list_append (groups,
+					tecla_model_get_group_name (model, i));
+	}
+
+	gtk_drop_down_set_model (group_dropdown, G_LIST_MODEL (groups));
+	gtk_drop_down_set_selected (group_dropdown,
+				    tecla_model_get_group (model));
+	gtk_widget_set_visible (GTK_WIDGET (group_dropdown), n_groups > 1);
 }
 
 static gboolean
@@ -232,6 +798,79 @@ popover_closed_cb (GtkPopover *popover,
 	g_idle_add ((GSourceFunc) unparent_popover, popover);
 }
 
+static gboolean
+is_dead_keyval (guint keyval)
+{
+	const gchar *name;
+
+	name = gdk_keyval_name (keyval);
+
+	return name && g_str_has_prefix (name, "dead_");
+}
+
+static gchar *
+get_keysyms_description (const KeyInfo *info)
+{
+	GString *str;
+	int i;
+
+	str = g_string_new (NULL);
+
+	for (i = 0; i < info->n_keysyms; i++) {
+		const gchar *name;
+
+		if (i > 0)
+			g_string_append_c (str, ' ');
+
+		/* Keysyms without a name are shown by value */
+		name = gdk_keyval_name (info->keysyms[i]);
+		if (name)
+			g_string_append (str, name);
+		else
+			g_string_append_printf (str, "0x%x", info->keysyms[i]);
+	}
+
+	return g_string_free (str, FALSE);
+}
+
+static GtkWidget *
+create_compose_list (GVariant *sequences)
+{
+	GtkWidget *scrolled, *flow_box;
+	GVariantIter iter;
+	const gchar *sequence, *result;
+
+	flow_box = gtk_flow_box_new ();
+	gtk_flow_box_set_selection_mode (GTK_FLOW_BOX (flow_box),
+					 GTK_SELECTION_NONE);
+	gtk_flow_box_set_min_children_per_line (GTK_FLOW_BOX (flow_box), 4);
+	gtk_flow_box_set_max_children_per_line (GTK_FLOW_BOX (flow_box), 8);
+	gtk_flow_box_set_column_spacing (GTK_FLOW_BOX (flow_box), 12);
+
+	g_variant_iter_init (&iter, sequences);
+	while (g_variant_iter_next (&iter, "(&s&s)", &sequence, &result)) {
+		g_autofree gchar *str = NULL;
+		GtkWidget *label;
+
+		str = g_strdup_printf ("%s → %s", sequence, result);
+		label = gtk_label_new (str);
+		gtk_label_set_xalign (GTK_LABEL (label), 0);
+		gtk_flow_box_append (GTK_FLOW_BOX (flow_box), label);
+	}
+
+	scrolled = gtk_scrolled_window_new ();
+	gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrolled),
+					GTK_POLICY_NEVER,
+					GTK_POLICY_AUTOMATIC);
+	gtk_scrolled_window_set_max_content_height (GTK_SCROLLED_WINDOW (scrolled),
+						    160);
+	gtk_scrolled_window_set_propagate_natural_height (GTK_SCROLLED_WINDOW (scrolled),
+							  TRUE);
+	gtk_scrolled_window_set_child (GTK_SCROLLED_WINDOW (scrolled), flow_box);
+
+	return scrolled;
+}
+
 static GtkPopover *
 create_popover (TeclaView    *view,
 		TeclaModel   *model,
@@ -241,11 +880,14 @@ create_popover (TeclaView    *view,
 {
 	int n_levels, i;
 	xkb_keycode_t keycode;
+	gboolean has_dead_keys = FALSE;
 	GtkPopover *popover;
 	GtkWidget *box;
 	g_autoptr (GArray) key_info = NULL;
 	g_autoptr (GString) a11y_data = NULL;
 
+	TECLA_PROFILER_BEGIN_MARK;
+
 	keycode = tecla_model_get_key_keycode (model, name);
 	n_levels = tecla_view_get_num_levels (view);
 
@@ -263,10 +905,16 @@ create_popover (TeclaView    *view,
 		if (info.keyval == 0)
 			continue;
 
+		info.keysyms = tecla_model_get_keysyms (model, info.level,
+							keycode, &info.n_keysyms);
+
+		if (is_dead_keyval (info.keyval))
+			has_dead_keys = TRUE;
+
 		g_array_append_val (key_info, info);
 	}
 
-	if (key_info->len < 2)
+	if (key_info->len < 2 && !has_dead_keys)
 		return NULL;
 
 	box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 6);
@@ -278,8 +926,8 @@ create_popover (TeclaView    *view,
 	for (i = 0; i < (int) key_info->len; i++) {
 		GtkWidget *hbox, *level, *etching, *desc;
 		KeyInfo *info;
-		g_autofree gchar *str;
-		g_autofree gchar *level_a11y = NULL;
+		g_autofree gchar *str = NULL;
+		g_autofree gchar *keysyms = NULL;
 
 		info = &g_array_index (key_info, KeyInfo, i);
 
@@ -290,21 +938,36 @@ create_popover (TeclaView    *view,
 		gtk_widget_add_css_class (level, "heading");
 		gtk_box_append (GTK_BOX (hbox), level);
 
-		str = tecla_model_get_key_label (model, info->level, name);
 		etching = tecla_key_new (NULL);
-		tecla_key_set_label (TECLA_KEY (etching), str);
+		tecla_key_set_label (TECLA_KEY (etching),
+				     tecla_model_get_key_label (model, info->level, name));
 		gtk_widget_add_css_class (etching, "tecla-key");
 		gtk_widget_set_sensitive (etching, FALSE);
 		gtk_box_append (GTK_BOX (hbox), etching);
 
-		desc = gtk_label_new (gdk_keyval_name (info->keyval));
+		keysyms = get_keysyms_description (info);
+		desc = gtk_label_new (keysyms);
 		gtk_box_append (GTK_BOX (hbox), desc);
 
 		gtk_box_append (GTK_BOX (box), hbox);
 
 		g_string_append_printf (a11y_data, _(" Level %d, character %s."),
-					info->level + 1,
-					gdk_keyval_name (info->keyval));
+					info->level + 1, keysyms);
+
+		/* Only dead keys need the compose table, load it on demand */
+		if (is_dead_keyval (info->keyval)) {
+			g_autoptr (GVariant) sequences = NULL;
+
+			sequences = tecla_compose_lookup (tecla_compose_get_default (),
+							  info->keyval);
+			if (sequences) {
+				gtk_box_append (GTK_BOX (box),
+						create_compose_list (sequences));
+				g_string_append_printf (a11y_data,
+							_(" Combines into %u characters."),
+							(guint) g_variant_n_children (sequences));
+			}
+		}
 
 	}
 
@@ -317,6 +980,10 @@ create_popover (TeclaView    *view,
 			  G_CALLBACK (popover_closed_cb), view);
 
 	*a11y_description = g_strdup (a11y_data->str);
+
+	tecla_stats_increment (TECLA_STATS_POPOVERS);
+	TECLA_PROFILER_END_MARK ("Create popover", "%s", name);
+
 	return popover;
 }
 
@@ -359,16 +1026,38 @@ connect_model (GtkWindow  *window,
 	       TeclaView  *view,
 	       TeclaModel *model)
 {
+	GtkDropDown *group_dropdown;
+
+	group_dropdown = g_object_get_data (G_OBJECT (window), "group-dropdown");
+	update_groups (group_dropdown, model);
+
 	tecla_view_set_model (view, model);
 	g_signal_connect_object (model, "notify::name",
 				 G_CALLBACK (name_notify_cb),
 				 window, 0);
+	g_signal_connect_object (group_dropdown, "notify::selected",
+				 G_CALLBACK (group_selected_cb),
+				 model, 0);
 
 	g_signal_connect_object (view, "key-activated",
 				 G_CALLBACK (key_activated_cb),
 				 model, 0);
 }
 
+static void
+disconnect_model (GtkWindow  *window,
+		  TeclaView  *view,
+		  TeclaModel *model)
+{
+	GtkDropDown *group_dropdown;
+
+	group_dropdown = g_object_get_data (G_OBJECT (window), "group-dropdown");
+
+	g_signal_handlers_disconnect_by_func (model, name_notify_cb, window);
+	g_signal_handlers_disconnect_by_func (group_dropdown, group_selected_cb, model);
+	g_signal_handlers_disconnect_by_func (view, key_activated_cb, model);
+}
+
 static void
 observer_keymap_notify_cb (TeclaKeymapObserver *observer,
 			   GParamSpec          *pspec,
@@ -378,7 +1067,16 @@ observer_keymap_notify_cb (TeclaKeymapObserver *observer,
 	struct xkb_keymap *xkb_keymap;
 
 	xkb_keymap = tecla_keymap_observer_get_keymap (observer);
+	if (!xkb_keymap)
+		return;
+
 	model = tecla_model_new_from_xkb_keymap (xkb_keymap);
+
+	if (app->main.model) {
+		disconnect_model (app->main.window,
+				  app->main.view, app->main.model);
+	}
+
 	connect_model (app->main.window,
 		       app->main.view, model);
 	update_title (app->main.window, model);
@@ -405,12 +1103,16 @@ window_removed_cb (TeclaApplication *tecla_app,
 {
 	TeclaInstance *instance = user_data;
 
+	if (instance->window != window)
+		return;
+
 	tecla_app->instances =
 		g_list_remove (tecla_app->instances, instance);
 
 	g_signal_handler_disconnect (tecla_app, instance->remove_handler_id);
 
 	g_clear_object (&instance->model);
+	g_free (instance->parent_handle);
 	g_free (instance);
 }
 
@@ -428,6 +1130,128 @@ main_window_removed_cb (TeclaApplication *tecla_app,
 	tecla_app->main.window = NULL;
 }
 
+static TeclaInstance *
+find_instance (TeclaApplication *app,
+	       const gchar      *parent_handle)
+{
+	GList *l;
+
+	/* Parentless previews are independent of each other */
+	if (!parent_handle || *parent_handle == '\0')
+		return NULL;
+
+	for (l = app->instances; l; l = l->next) {
+		TeclaInstance *instance = l->data;
+
+		if (g_strcmp0 (instance->parent_handle, parent_handle) == 0)
+			return instance;
+	}
+
+	return NULL;
+}
+
+static TeclaInstance *
+create_instance (TeclaApplication *app,
+		 const gchar      *parent_handle)
+{
+	TeclaInstance *instance = g_new0 (TeclaInstance, 1);
+
+	instance->window = create_window (app, &instance->view);
+	instance->parent_handle = g_strdup (parent_handle);
+
+#ifdef GDK_WINDOWING_WAYLAND
+	if (parent_handle &&
+	    GDK_IS_WAYLAND_DISPLAY (gtk_widget_get_display (GTK_WIDGET (instance->window)))) {
+		GdkSurface *surface;
+
+		gtk_widget_realize (GTK_WIDGET (instance->window));
+		surface = gtk_native_get_surface (GTK_NATIVE (instance->window));
+		gdk_wayland_toplevel_set_transient_for_exported (GDK_TOPLEVEL (surface),
+								 parent_handle);
+	}
+#endif
+
+	instance->remove_handler_id =
+		g_signal_connect (app, "window-removed",
+				  G_CALLBACK (window_removed_cb),
+				  instance);
+
+	app->instances = g_list_prepend (app->instances, instance);
+
+	return instance;
+}
+
+static void
+set_instance_model (TeclaInstance *instance,
+		    TeclaModel    *model)
+{
+	if (instance->model == model)
+		return;
+
+	if (instance->model) {
+		disconnect_model (instance->window,
+				  instance->view,
+				  instance->model);
+	}
+
+	g_set_object (&instance->model, model);
+
+	if (instance->model) {
+		connect_model (instance->window,
+			       instance->view,
+			       instance->model);
+		update_title (instance->window, instance->model);
+	}
+}
+
+static void
+first_frame_cb (GdkFrameClock    *frame_clock,
+		TeclaApplication *app)
+{
+	GdkFrameTimings *timings;
+	gint64 time;
+
+	/* Presentation times arrive with later frames */
+	if (app->startup_frame < 0) {
+		app->startup_frame = gdk_frame_clock_get_frame_counter (frame_clock);
+		gdk_frame_clock_request_phase (frame_clock,
+					       GDK_FRAME_CLOCK_PHASE_AFTER_PAINT);
+		return;
+	}
+
+	timings = gdk_frame_clock_get_timings (frame_clock, app->startup_frame);
+	if (timings && !gdk_frame_timings_get_complete (timings)) {
+		gdk_frame_clock_request_phase (frame_clock,
+					       GDK_FRAME_CLOCK_PHASE_AFTER_PAINT);
+		return;
+	}
+
+	time = timings ? gdk_frame_timings_get_presentation_time (timings) : 0;
+	if (time == 0 && timings)
+		time = gdk_frame_timings_get_predicted_presentation_time (timings);
+	if (time == 0)
+		time = g_get_monotonic_time ();
+
+	tecla_startup_mark (TECLA_STARTUP_FIRST_FRAME, time);
+
+	g_signal_handlers_disconnect_by_func (frame_clock, first_frame_cb, app);
+	g_application_quit (G_APPLICATION (app));
+}
+
+static void
+watch_first_frame (TeclaApplication *app,
+		   GtkWindow        *window)
+{
+	GdkFrameClock *frame_clock;
+
+	frame_clock = gtk_widget_get_frame_clock (GTK_WIDGET (window));
+	g_return_if_fail (frame_clock != NULL);
+
+	app->startup_frame = -1;
+	g_signal_connect (frame_clock, "after-paint",
+			  G_CALLBACK (first_frame_cb), app);
+}
+
 static void
 tecla_application_activate (GApplication *app)
 {
@@ -435,7 +1259,10 @@ tecla_application_activate (GApplication *app)
 	g_autofree char *layout = g_steal_pointer (&tecla_app->layout);
 	g_autofree char *parent_handle = g_steal_pointer (&tecla_app->parent_handle);
 
-	if (!layout) {
+	if (tecla_app->show_gallery) {
+		tecla_app->show_gallery = FALSE;
+		present_gallery (tecla_app);
+	} else if (!layout) {
 		if (!tecla_app->main.window) {
 			tecla_app->main.window =
 				create_window (tecla_app, &tecla_app->main.view);
@@ -453,43 +1280,369 @@ tecla_application_activate (GApplication *app)
 		}
 
 		gtk_window_present (tecla_app->main.window);
+
+		if (tecla_app->benchmark_startup)
+			watch_first_frame (tecla_app, tecla_app->main.window);
 	} else {
-		TeclaInstance *instance = g_new0 (TeclaInstance, 1);
+		g_autoptr (TeclaModel) model = NULL;
+		TeclaInstance *instance;
 
-		instance->window = create_window (tecla_app, &instance->view);
+		model = tecla_model_new_from_layout_name (layout);
+		instance = create_instance (tecla_app, parent_handle);
+		set_instance_model (instance, model);
 
-		instance->model =
-			tecla_model_new_from_layout_name (layout);
+		gtk_window_present (instance->window);
 
-		if (instance->model) {
-			connect_model (instance->window,
-				       instance->view,
-				       instance->model);
-			update_title (instance->window, instance->model);
-		}
+		if (tecla_app->benchmark_startup)
+			watch_first_frame (tecla_app, instance->window);
+	}
+}
 
-#ifdef GDK_WINDOWING_WAYLAND
-		if (parent_handle &&
-		    GDK_IS_WAYLAND_DISPLAY (gtk_widget_get_display (GTK_WIDGET (instance->window)))) {
-			GdkSurface *surface;
-
-			gtk_widget_realize (GTK_WIDGET (instance->window));
-			surface = gtk_native_get_surface (GTK_NATIVE (instance->window));
-			gdk_wayland_toplevel_set_transient_for_exported (GDK_TOPLEVEL (surface),
-									 parent_handle);
+static gboolean
+show_preview (TeclaApplication  *app,
+	      const gchar       *layout,
+	      const gchar       *variant,
+	      const gchar       *parent_handle,
+	      GError           **error)
+{
+	g_autoptr (TeclaModel) model = NULL;
+	g_autofree gchar *name = NULL;
+	TeclaInstance *instance;
+
+	name = tecla_model_build_layout_name (layout, variant, NULL);
+
+	model = tecla_model_new_from_layout_name (name);
+	if (!model) {
+		g_autofree gchar *message = NULL;
+
+		message = tecla_registry_format_suggestions (tecla_registry_get_default (),
+							     name);
+		g_set_error_literal (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+				     message);
+		return FALSE;
+	}
+
+	if (*parent_handle == '\0')
+		parent_handle = NULL;
+
+	/* Retarget the preview already shown for this parent, if any;
+	 * without a parent there is nothing to match against.
+	 */
+	instance = find_instance (app, parent_handle);
+	if (!instance)
+		instance = create_instance (app, parent_handle);
+
+	set_instance_model (instance, model);
+	gtk_window_present (instance->window);
+
+	return TRUE;
+}
+
+static void
+gallery_layout_activated_cb (TeclaGallery     *gallery,
+			     const gchar      *name,
+			     TeclaApplication *app)
+{
+	g_autoptr (GError) error = NULL;
+
+	if (!show_preview (app, name, "", "", &error))
+		g_warning ("Could not show layout: %s", error->message);
+}
+
+static void
+present_gallery (TeclaApplication *app)
+{
+	GtkWidget *toolbar_view, *gallery;
+
+	if (app->gallery_window) {
+		gtk_window_present (app->gallery_window);
+		return;
+	}
+
+	gallery = tecla_gallery_new ();
+	g_signal_connect (gallery, "layout-activated",
+			  G_CALLBACK (gallery_layout_activated_cb), app);
+
+	toolbar_view = adw_toolbar_view_new ();
+	adw_toolbar_view_add_top_bar (ADW_TOOLBAR_VIEW (toolbar_view),
+				      adw_header_bar_new ());
+	adw_toolbar_view_set_content (ADW_TOOLBAR_VIEW (toolbar_view), gallery);
+
+	app->gallery_window = GTK_WINDOW (adw_window_new ());
+	gtk_window_set_title (app->gallery_window, _("Keyboard Layouts"));
+	gtk_window_set_default_size (app->gallery_window, 1000, 700);
+	adw_window_set_content (ADW_WINDOW (app->gallery_window), toolbar_view);
+	g_object_add_weak_pointer (G_OBJECT (app->gallery_window),
+				   (gpointer *) &app->gallery_window);
+
+	gtk_application_add_window (GTK_APPLICATION (app), app->gallery_window);
+	gtk_window_present (app->gallery_window);
+}
+
+static void
+thumbnail_rendered_cb (GObject      *source,
+		       GAsyncResult *result,
+		       gpointer      user_data)
+{
+	GDBusMethodInvocation *invocation = user_data;
+	g_autoptr (TeclaThumbnail) thumbnail = NULL;
+	g_autoptr (GUnixFDList) fd_list = NULL;
+	g_autoptr (GError) error = NULL;
+
+	g_application_release (g_application_get_default ());
+
+	thumbnail = tecla_thumbnail_render_finish (result, &error);
+	if (!thumbnail) {
+		g_dbus_method_invocation_return_gerror (invocation, error);
+		return;
+	}
+
+	/* The fd list takes ownership of the descriptor */
+	fd_list = g_unix_fd_list_new_from_array (&thumbnail->fd, 1);
+	thumbnail->fd = -1;
+
+	g_dbus_method_invocation_return_value_with_unix_fd_list (invocation,
+								 g_variant_new ("(hiiiu)", 0,
+										thumbnail->width,
+										thumbnail->height,
+										thumbnail->stride,
+										(guint32) thumbnail->format),
+								 fd_list);
+}
+
+static void
+render_thumbnail (TeclaApplication      *app,
+		  GVariant              *parameters,
+		  GDBusMethodInvocation *invocation)
+{
+	g_autofree gchar *name = NULL;
+	const gchar *layout, *variant;
+	int width, height, scale;
+
+	g_variant_get (parameters, "(&s&siii)",
+		       &layout, &variant, &width, &height, &scale);
+
+	if (width <= 0 || height <= 0 || scale <= 0 ||
+	    width > TECLA_THUMBNAIL_MAX_SIZE / scale ||
+	    height > TECLA_THUMBNAIL_MAX_SIZE / scale) {
+		g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+						       G_DBUS_ERROR_INVALID_ARGS,
+						       "Invalid thumbnail size %dx%d@%d",
+						       width, height, scale);
+		return;
+	}
+
+	name = tecla_model_build_layout_name (layout, variant, NULL);
+
+	/* Keep a resident instance around until the reply is sent */
+	g_application_hold (G_APPLICATION (app));
+	tecla_thumbnail_render_async (name, width, height, scale,
+				      G_PRIORITY_DEFAULT, NULL,
+				      thumbnail_rendered_cb, invocation);
+}
+
+static void
+preview_method_call (GDBusConnection       *connection,
+		     const gchar           *sender,
+		     const gchar           *object_path,
+		     const gchar           *interface_name,
+		     const gchar           *method_name,
+		     GVariant              *parameters,
+		     GDBusMethodInvocation *invocation,
+		     gpointer               user_data)
+{
+	TeclaApplication *app = user_data;
+	g_autoptr (GError) error = NULL;
+
+	if (g_strcmp0 (method_name, "Show") == 0) {
+		const gchar *layout, *variant, *parent_handle;
+
+		g_variant_get (parameters, "(&s&s&s)",
+			       &layout, &variant, &parent_handle);
+		show_preview (app, layout, variant, parent_handle, &error);
+	} else if (g_strcmp0 (method_name, "ShowMany") == 0) {
+		g_autoptr (GVariantIter) iter = NULL;
+		const gchar *layout, *variant, *parent_handle;
+
+		g_variant_get (parameters, "(a(sss))", &iter);
+
+		while (g_variant_iter_next (iter, "(&s&s&s)",
+					    &layout, &variant, &parent_handle)) {
+			g_autoptr (GError) show_error = NULL;
+
+			/* Show all valid previews, report the first failure */
+			if (!show_preview (app, layout, variant, parent_handle,
+					   &show_error) && !error)
+				error = g_steal_pointer (&show_error);
 		}
-#endif
+	} else if (g_strcmp0 (method_name, "RenderThumbnail") == 0) {
+		/* Replied to from thumbnail_rendered_cb() */
+		render_thumbnail (app, parameters, invocation);
+		return;
+	}
 
-		instance->remove_handler_id =
-			g_signal_connect (tecla_app, "window-removed",
-					  G_CALLBACK (window_removed_cb),
-					  instance);
+	if (error)
+		g_dbus_method_invocation_return_gerror (invocation, error);
+	else
+		g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static const GDBusInterfaceVTable preview_vtable = {
+	preview_method_call,
+	NULL,
+	NULL,
+};
+
+static GVariant *
+debug_get_property (GDBusConnection  *connection,
+		    const gchar      *sender,
+		    const gchar      *object_path,
+		    const gchar      *interface_name,
+		    const gchar      *property_name,
+		    GError          **error,
+		    gpointer          user_data)
+{
+	if (g_strcmp0 (property_name, "Counters") == 0)
+		return tecla_stats_get_counters ();
+	else if (g_strcmp0 (property_name, "Histograms") == 0)
+		return tecla_stats_get_histograms ();
+
+	g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+		     "Unknown property %s", property_name);
+	return NULL;
+}
 
-		tecla_app->instances =
-			g_list_prepend (tecla_app->instances, instance);
+static const GDBusInterfaceVTable debug_vtable = {
+	NULL,
+	debug_get_property,
+	NULL,
+};
 
-		gtk_window_present (instance->window);
+static guint
+register_interface (GDBusConnection             *connection,
+		    const gchar                 *object_path,
+		    const gchar                 *resource,
+		    const GDBusInterfaceVTable  *vtable,
+		    gpointer                     user_data,
+		    GError                     **error)
+{
+	g_autoptr (GDBusNodeInfo) node_info = NULL;
+	g_autoptr (GBytes) xml = NULL;
+
+	xml = g_resources_lookup_data (resource,
+				       G_RESOURCE_LOOKUP_FLAGS_NONE,
+				       error);
+	if (!xml)
+		return 0;
+
+	node_info = g_dbus_node_info_new_for_xml (g_bytes_get_data (xml, NULL),
+						  error);
+	if (!node_info)
+		return 0;
+
+	return g_dbus_connection_register_object (connection,
+						  object_path,
+						  node_info->interfaces[0],
+						  vtable,
+						  user_data, NULL,
+						  error);
+}
+
+static gboolean
+tecla_application_dbus_register (GApplication     *app,
+				 GDBusConnection  *connection,
+				 const gchar      *object_path,
+				 GError          **error)
+{
+	TeclaApplication *tecla_app = TECLA_APPLICATION (app);
+
+	if (!G_APPLICATION_CLASS (tecla_application_parent_class)->dbus_register (app,
+										   connection,
+										   object_path,
+										   error))
+		return FALSE;
+
+	tecla_app->preview_id =
+		register_interface (connection, object_path,
+				    "/org/gnome/tecla/org.gnome.Tecla.Preview.xml",
+				    &preview_vtable, app, error);
+	if (tecla_app->preview_id == 0)
+		return FALSE;
+
+	tecla_app->debug_id =
+		register_interface (connection, object_path,
+				    "/org/gnome/tecla/org.gnome.Tecla.Debug.xml",
+				    &debug_vtable, app, error);
+
+	return tecla_app->debug_id != 0;
+}
+
+static void
+tecla_application_dbus_unregister (GApplication    *app,
+				   GDBusConnection *connection,
+				   const gchar     *object_path)
+{
+	TeclaApplication *tecla_app = TECLA_APPLICATION (app);
+
+	if (tecla_app->preview_id) {
+		g_dbus_connection_unregister_object (connection,
+						     tecla_app->preview_id);
+		tecla_app->preview_id = 0;
 	}
+
+	if (tecla_app->debug_id) {
+		g_dbus_connection_unregister_object (connection,
+						     tecla_app->debug_id);
+		tecla_app->debug_id = 0;
+	}
+
+	G_APPLICATION_CLASS (tecla_application_parent_class)->dbus_unregister (app,
+									 connection,
+									 object_path);
+}
+
+static void
+tecla_application_startup (GApplication *app)
+{
+	G_APPLICATION_CLASS (tecla_application_parent_class)->startup (app);
+
+	/* Only the primary instance needs to initialize the toolkit */
+	tecla_startup_begin (TECLA_STARTUP_ADW_INIT);
+	adw_init ();
+	tecla_startup_end (TECLA_STARTUP_ADW_INIT);
+}
+
+static void
+tecla_application_shutdown (GApplication *app)
+{
+	TeclaApplication *tecla_app = TECLA_APPLICATION (app);
+
+	g_clear_handle_id (&tecla_app->spare_window_id, g_source_remove);
+
+	if (tecla_app->spare_window) {
+		gtk_window_destroy (tecla_app->spare_window);
+		tecla_app->spare_window = NULL;
+		tecla_app->spare_view = NULL;
+	}
+
+	if (tecla_app->latency_probe) {
+		g_autofree gchar *report = NULL;
+
+		report = tecla_latency_probe_format_report (tecla_app->latency_probe);
+		g_print ("%s", report);
+		g_clear_object (&tecla_app->latency_probe);
+	}
+
+	g_clear_object (&tecla_app->key_recorder);
+
+	if (tecla_app->benchmark_startup) {
+		g_autofree gchar *report = NULL;
+
+		report = tecla_startup_format_report ();
+		g_print ("%s", report);
+	}
+
+	G_APPLICATION_CLASS (tecla_application_parent_class)->shutdown (app);
 }
 
 static void
@@ -497,6 +1650,10 @@ tecla_application_class_init (TeclaApplicationClass *klass)
 {
 	GApplicationClass *application_class = G_APPLICATION_CLASS (klass);
 
+	application_class->startup = tecla_application_startup;
+	application_class->shutdown = tecla_application_shutdown;
+	application_class->dbus_register = tecla_application_dbus_register;
+	application_class->dbus_unregister = tecla_application_dbus_unregister;
 	application_class->command_line = tecla_application_command_line;
 	application_class->activate = tecla_application_activate;
 	application_class->handle_local_options = tecla_application_handle_local_options;
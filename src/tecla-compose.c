@@ -0,0 +1,417 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tecla-compose.h"
+
+#include <errno.h>
+#include <locale.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <xkbcommon/xkbcommon-compose.h>
+
+#include "tecla-util.h"
+
+/* Bump whenever the cache contents change */
+#define COMPOSE_VERSION 1
+#define COMPOSE_FORMAT "(uta(ua(ss)))"
+
+struct _TeclaCompose
+{
+	GObject parent_instance;
+	GVariant *data;
+	GVariant *results; /* a(ua(ss)), sorted by dead keysym */
+	GHashTable *sequences; /* utf8 -> GArray of TeclaComposeSequence */
+};
+
+G_DEFINE_TYPE (TeclaCompose, tecla_compose, G_TYPE_OBJECT)
+
+static void
+tecla_compose_finalize (GObject *object)
+{
+	TeclaCompose *compose = TECLA_COMPOSE (object);
+
+	g_clear_pointer (&compose->sequences, g_hash_table_unref);
+	g_clear_pointer (&compose->results, g_variant_unref);
+	g_clear_pointer (&compose->data, g_variant_unref);
+
+	G_OBJECT_CLASS (tecla_compose_parent_class)->finalize (object);
+}
+
+static void
+tecla_compose_class_init (TeclaComposeClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = tecla_compose_finalize;
+}
+
+static void
+tecla_compose_init (TeclaCompose *compose)
+{
+}
+
+static gchar *
+get_cache_path (const gchar *locale)
+{
+	g_autofree gchar *filename = NULL;
+
+	filename = g_strdup_printf ("%s.gvariant", locale);
+	g_strdelimit (filename, G_DIR_SEPARATOR_S, '_');
+
+	return g_build_filename (g_get_user_cache_dir (),
+				 "tecla", "compose", filename, NULL);
+}
+
+static GVariant *
+load_data (const gchar *path,
+	   guint64      stamp)
+{
+	g_autoptr (GMappedFile) mapped_file = NULL;
+	g_autoptr (GBytes) bytes = NULL;
+	g_autoptr (GVariant) data = NULL;
+	guint32 version;
+	guint64 data_stamp;
+
+	mapped_file = g_mapped_file_new (path, FALSE, NULL);
+	if (!mapped_file)
+		return NULL;
+
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	data = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (COMPOSE_FORMAT),
+							     bytes, FALSE));
+
+	g_variant_get (data, "(ut*)", &version, &data_stamp, NULL);
+	if (version != COMPOSE_VERSION || data_stamp != stamp)
+		return NULL;
+
+	return g_steal_pointer (&data);
+}
+
+static void
+save_data (const gchar *path,
+	   GVariant    *data)
+{
+	g_autofree gchar *dir = NULL;
+	g_autoptr (GError) error = NULL;
+
+	dir = g_path_get_dirname (path);
+	if (g_mkdir_with_parents (dir, 0700) < 0) {
+		g_debug ("Could not create %s: %s", dir, g_strerror (errno));
+		return;
+	}
+
+	if (!g_file_set_contents (path, g_variant_get_data (data),
+				  g_variant_get_size (data), &error))
+		g_debug ("Could not save compose index: %s", error->message);
+}
+
+static gboolean
+is_dead_keysym (xkb_keysym_t keysym)
+{
+	gchar name[64];
+
+	if (xkb_keysym_get_name (keysym, name, sizeof (name)) < 0)
+		return FALSE;
+
+	return g_str_has_prefix (name, "dead_");
+}
+
+static void
+append_keysym (GString      *label,
+	       xkb_keysym_t  keysym)
+{
+	gchar buf[64];
+
+	if (label->len > 0)
+		g_string_append_c (label, ' ');
+
+	/* Printable characters are shown as is, anything else by name */
+	if (xkb_keysym_to_utf8 (keysym, buf, sizeof (buf)) > 1 &&
+	    g_unichar_isgraph (g_utf8_get_char (buf))) {
+		g_string_append (label, buf);
+		return;
+	}
+
+	if (xkb_keysym_get_name (keysym, buf, sizeof (buf)) < 0)
+		g_snprintf (buf, sizeof (buf), "0x%x", keysym);
+
+	g_string_append (label, buf);
+}
+
+static void
+add_entry (GHashTable                     *results,
+	   struct xkb_compose_table_entry *entry)
+{
+	g_autoptr (GString) label = NULL;
+	GVariantBuilder *builder;
+	const xkb_keysym_t *sequence;
+	const gchar *utf8;
+	gchar buf[8];
+	size_t n_keysyms, i;
+
+	sequence = xkb_compose_table_entry_sequence (entry, &n_keysyms);
+	if (n_keysyms < 2 || !is_dead_keysym (sequence[0]))
+		return;
+
+	utf8 = xkb_compose_table_entry_utf8 (entry);
+	if (!utf8 || !*utf8) {
+		if (xkb_keysym_to_utf8 (xkb_compose_table_entry_keysym (entry),
+					buf, sizeof (buf)) <= 1)
+			return;
+
+		utf8 = buf;
+	}
+
+	label = g_string_new (NULL);
+	for (i = 1; i < n_keysyms; i++)
+		append_keysym (label, sequence[i]);
+
+	builder = g_hash_table_lookup (results, GUINT_TO_POINTER (sequence[0]));
+	if (!builder) {
+		builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ss)"));
+		g_hash_table_insert (results, GUINT_TO_POINTER (sequence[0]),
+				     builder);
+	}
+
+	g_variant_builder_add (builder, "(ss)", label->str, utf8);
+}
+
+static int
+compare_keysyms (gconstpointer a,
+		 gconstpointer b)
+{
+	guint keysym_a = GPOINTER_TO_UINT (*(gpointer *) a);
+	guint keysym_b = GPOINTER_TO_UINT (*(gpointer *) b);
+
+	return (keysym_a > keysym_b) - (keysym_a < keysym_b);
+}
+
+static GVariant *
+build_data (const gchar *locale,
+	    guint64      stamp)
+{
+	struct xkb_context *ctx;
+	struct xkb_compose_table *table;
+	g_autoptr (GHashTable) results = NULL;
+	g_autoptr (GPtrArray) keysyms = NULL;
+	GVariantBuilder builder;
+	GHashTableIter iter;
+	gpointer keysym;
+	guint i;
+
+	results = g_hash_table_new_full (NULL, NULL, NULL,
+					 (GDestroyNotify) g_variant_builder_unref);
+
+	ctx = tecla_util_create_xkb_context ();
+	table = xkb_compose_table_new_from_locale (ctx, locale,
+						   XKB_COMPOSE_COMPILE_NO_FLAGS);
+	xkb_context_unref (ctx);
+
+	if (table) {
+		struct xkb_compose_table_iterator *table_iter;
+		struct xkb_compose_table_entry *entry;
+
+		table_iter = xkb_compose_table_iterator_new (table);
+		while ((entry = xkb_compose_table_iterator_next (table_iter)))
+			add_entry (results, entry);
+
+		xkb_compose_table_iterator_free (table_iter);
+		xkb_compose_table_unref (table);
+	} else {
+		g_debug ("No compose table for locale %s", locale);
+	}
+
+	keysyms = g_ptr_array_new ();
+	g_hash_table_iter_init (&iter, results);
+	while (g_hash_table_iter_next (&iter, &keysym, NULL))
+		g_ptr_array_add (keysyms, keysym);
+
+	g_ptr_array_sort (keysyms, compare_keysyms);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ua(ss))"));
+
+	for (i = 0; i < keysyms->len; i++) {
+		GVariantBuilder *sequences;
+
+		sequences = g_hash_table_lookup (results, keysyms->pdata[i]);
+		g_variant_builder_add (&builder, "(u@a(ss))",
+				       GPOINTER_TO_UINT (keysyms->pdata[i]),
+				       g_variant_builder_end (sequences));
+	}
+
+	return g_variant_ref_sink (g_variant_new ("(ut@a(ua(ss)))",
+						  COMPOSE_VERSION, stamp,
+						  g_variant_builder_end (&builder)));
+}
+
+static TeclaCompose *
+tecla_compose_new (void)
+{
+	TeclaCompose *compose;
+	g_autofree gchar *path = NULL;
+	const gchar *locale;
+	guint64 stamp;
+
+	locale = setlocale (LC_CTYPE, NULL);
+	if (!locale)
+		locale = "C";
+
+	stamp = tecla_util_get_compose_stamp (locale);
+	path = get_cache_path (locale);
+
+	compose = g_object_new (TECLA_TYPE_COMPOSE, NULL);
+	compose->data = load_data (path, stamp);
+
+	if (!compose->data) {
+		compose->data = build_data (locale, stamp);
+		save_data (path, compose->data);
+	}
+
+	compose->results = g_variant_get_child_value (compose->data, 2);
+
+	return compose;
+}
+
+TeclaCompose *
+tecla_compose_get_default (void)
+{
+	static TeclaCompose *compose = NULL;
+
+	/* The compose table is large, only load it when first needed */
+	if (g_once_init_enter (&compose))
+		g_once_init_leave (&compose, tecla_compose_new ());
+
+	return compose;
+}
+
+GVariant *
+tecla_compose_lookup (TeclaCompose *compose,
+		      xkb_keysym_t  dead_keysym)
+{
+	gsize low = 0, high = g_variant_n_children (compose->results);
+
+	while (low < high) {
+		gsize mid = low + (high - low) / 2;
+		guint32 keysym;
+
+		g_variant_get_child (compose->results, mid, "(u*)", &keysym, NULL);
+
+		if (keysym == dead_keysym) {
+			GVariant *sequences;
+
+			g_variant_get_child (compose->results, mid, "(u@a(ss))",
+					     NULL, &sequences);
+			return sequences;
+		}
+
+		if (keysym < dead_keysym)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return NULL;
+}
+
+static xkb_keysym_t
+parse_keysym (const gchar *label)
+{
+	gunichar ch;
+
+	if (!*label)
+		return XKB_KEY_NoSymbol;
+
+	/* Reverses append_keysym() for a single keysym */
+	ch = g_utf8_get_char (label);
+	if (label[g_utf8_skip[*(guchar *) label]] == '\0' &&
+	    g_unichar_isgraph (ch))
+		return xkb_utf32_to_keysym (ch);
+
+	return xkb_keysym_from_name (label, XKB_KEYSYM_NO_FLAGS);
+}
+
+static GHashTable *
+build_sequences (TeclaCompose *compose)
+{
+	GHashTable *sequences;
+	GVariantIter iter;
+	GVariant *entries;
+	guint32 dead_keysym;
+
+	sequences = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+					   (GDestroyNotify) g_array_unref);
+
+	g_variant_iter_init (&iter, compose->results);
+	while (g_variant_iter_next (&iter, "(u@a(ss))", &dead_keysym, &entries)) {
+		GVariantIter entry_iter;
+		const gchar *label, *utf8;
+
+		g_variant_iter_init (&entry_iter, entries);
+		while (g_variant_iter_next (&entry_iter, "(&s&s)", &label, &utf8)) {
+			TeclaComposeSequence sequence;
+			GArray *array;
+
+			/* Positions only describe a dead key plus one more key */
+			if (strchr (label, ' '))
+				continue;
+
+			sequence.dead_keysym = dead_keysym;
+			sequence.keysym = parse_keysym (label);
+			if (sequence.keysym == XKB_KEY_NoSymbol)
+				continue;
+
+			/* Strings point into the mapped data, which outlives us */
+			array = g_hash_table_lookup (sequences, utf8);
+			if (!array) {
+				array = g_array_new (FALSE, FALSE,
+						     sizeof (TeclaComposeSequence));
+				g_hash_table_insert (sequences, (gpointer) utf8, array);
+			}
+
+			g_array_append_val (array, sequence);
+		}
+
+		g_variant_unref (entries);
+	}
+
+	return sequences;
+}
+
+/* Returns the dead key sequences producing @utf8, by dead keysym */
+const TeclaComposeSequence *
+tecla_compose_find_sequences (TeclaCompose *compose,
+			      const gchar  *utf8,
+			      guint        *n_sequences)
+{
+	GArray *array;
+
+	/* Only built when a character is not directly on the layout */
+	if (g_once_init_enter (&compose->sequences))
+		g_once_init_leave (&compose->sequences, build_sequences (compose));
+
+	array = g_hash_table_lookup (compose->sequences, utf8);
+	if (!array) {
+		*n_sequences = 0;
+		return NULL;
+	}
+
+	*n_sequences = array->len;
+	return (const TeclaComposeSequence *) array->data;
+}
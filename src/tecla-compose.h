@@ -0,0 +1,44 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <glib-object.h>
+#include <xkbcommon/xkbcommon.h>
+
+#pragma once
+
+typedef struct
+{
+	xkb_keysym_t dead_keysym;
+	xkb_keysym_t keysym;
+} TeclaComposeSequence;
+
+#define TECLA_TYPE_COMPOSE (tecla_compose_get_type ())
+G_DECLARE_FINAL_TYPE (TeclaCompose, tecla_compose,
+		      TECLA, COMPOSE,
+		      GObject)
+
+TeclaCompose * tecla_compose_get_default (void);
+
+GVariant * tecla_compose_lookup (TeclaCompose *compose,
+				 xkb_keysym_t  dead_keysym);
+
+const TeclaComposeSequence * tecla_compose_find_sequences (TeclaCompose *compose,
+							  const gchar  *utf8,
+							  guint        *n_sequences);
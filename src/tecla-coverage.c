@@ -0,0 +1,483 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tecla-coverage.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+
+#include "tecla-model.h"
+#include "tecla-registry.h"
+
+/* Bump whenever the index contents change */
+#define COVERAGE_VERSION 2
+#define COVERAGE_FORMAT "(ua(st)asa(uqqyy))"
+
+/* Laid out as the serialized form of (uqqyy), sorted by codepoint */
+typedef struct
+{
+	guint32 codepoint;
+	guint16 layout;
+	guint16 key;
+	guint8 group;
+	guint8 level;
+	guint8 padding[2];
+} CoverageRecord;
+
+G_STATIC_ASSERT (sizeof (CoverageRecord) == 12);
+
+typedef struct
+{
+	gunichar codepoint;
+	const gchar *key; /* interned */
+	guint8 group;
+	guint8 level;
+} LayoutRecord;
+
+typedef struct
+{
+	gchar *name;
+	guint64 stamp;
+	GArray *records; /* LayoutRecord */
+	TeclaModel *model;
+	GHashTable *seen;
+} CoverageJob;
+
+struct _TeclaCoverage
+{
+	GObject parent_instance;
+	GVariant *data;
+	GVariant *layouts;
+	GVariant *keys;
+	GVariant *records_data;
+	const CoverageRecord *records;
+	gsize n_records;
+};
+
+G_DEFINE_TYPE (TeclaCoverage, tecla_coverage, G_TYPE_OBJECT)
+
+static void
+tecla_coverage_finalize (GObject *object)
+{
+	TeclaCoverage *coverage = TECLA_COVERAGE (object);
+
+	g_clear_pointer (&coverage->records_data, g_variant_unref);
+	g_clear_pointer (&coverage->keys, g_variant_unref);
+	g_clear_pointer (&coverage->layouts, g_variant_unref);
+	g_clear_pointer (&coverage->data, g_variant_unref);
+
+	G_OBJECT_CLASS (tecla_coverage_parent_class)->finalize (object);
+}
+
+static void
+tecla_coverage_class_init (TeclaCoverageClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = tecla_coverage_finalize;
+}
+
+static void
+tecla_coverage_init (TeclaCoverage *coverage)
+{
+}
+
+static void
+coverage_job_free (CoverageJob *job)
+{
+	g_free (job->name);
+	g_array_unref (job->records);
+	g_free (job);
+}
+
+static gchar *
+get_cache_path (void)
+{
+	return g_build_filename (g_get_user_cache_dir (),
+				 "tecla", "coverage.gvariant", NULL);
+}
+
+static GVariant *
+load_data (const gchar *path)
+{
+	g_autoptr (GMappedFile) mapped_file = NULL;
+	g_autoptr (GBytes) bytes = NULL;
+	g_autoptr (GVariant) data = NULL;
+	guint32 version;
+
+	mapped_file = g_mapped_file_new (path, FALSE, NULL);
+	if (!mapped_file)
+		return NULL;
+
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	data = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (COVERAGE_FORMAT),
+							     bytes, FALSE));
+
+	g_variant_get_child (data, 0, "u", &version);
+	if (version != COVERAGE_VERSION)
+		return NULL;
+
+	return g_steal_pointer (&data);
+}
+
+static void
+save_data (const gchar *path,
+	   GVariant    *data)
+{
+	g_autofree gchar *dir = NULL;
+	g_autoptr (GError) error = NULL;
+
+	dir = g_path_get_dirname (path);
+	if (g_mkdir_with_parents (dir, 0700) < 0) {
+		g_debug ("Could not create %s: %s", dir, g_strerror (errno));
+		return;
+	}
+
+	if (!g_file_set_contents (path, g_variant_get_data (data),
+				  g_variant_get_size (data), &error))
+		g_debug ("Could not save coverage index: %s", error->message);
+}
+
+static void
+collect_keysym (xkb_keycode_t  keycode,
+		int            group,
+		int            level,
+		xkb_keysym_t   keysym,
+		CoverageJob   *job)
+{
+	LayoutRecord record;
+	const gchar *key;
+
+	record.codepoint = xkb_keysym_to_utf32 (keysym);
+	if (record.codepoint == 0 || g_unichar_iscntrl (record.codepoint))
+		return;
+
+	/* Keysyms come lowest level first, keep the easiest to reach */
+	if (!g_hash_table_add (job->seen, GUINT_TO_POINTER (record.codepoint)))
+		return;
+
+	key = tecla_model_get_keycode_key (job->model, keycode);
+	if (!key)
+		return;
+
+	record.key = g_intern_string (key);
+	record.group = group;
+	record.level = level;
+	g_array_append_val (job->records, record);
+}
+
+static void
+index_layout (CoverageJob *job,
+	      GAsyncQueue *done)
+{
+	job->model = tecla_model_new_from_layout_name (job->name);
+
+	if (job->model) {
+		job->seen = g_hash_table_new (NULL, NULL);
+		tecla_model_foreach_keysym (job->model,
+					    (TeclaModelKeysymFunc) collect_keysym,
+					    job);
+		g_clear_pointer (&job->seen, g_hash_table_unref);
+		g_clear_object (&job->model);
+	} else {
+		g_printerr ("%s: Could not compile keymap\n", job->name);
+	}
+
+	g_async_queue_push (done, job);
+}
+
+static gboolean
+index_layouts (GPtrArray  *jobs,
+	       GError    **error)
+{
+	g_autoptr (GAsyncQueue) done = NULL;
+	GThreadPool *pool;
+	guint i;
+
+	done = g_async_queue_new ();
+	pool = g_thread_pool_new ((GFunc) index_layout, done,
+				  (int) g_get_num_processors (), TRUE,
+				  error);
+	if (!pool)
+		return FALSE;
+
+	for (i = 0; i < jobs->len; i++)
+		g_thread_pool_push (pool, jobs->pdata[i], NULL);
+
+	for (i = 0; i < jobs->len; i++)
+		g_async_queue_pop (done);
+
+	g_thread_pool_free (pool, FALSE, TRUE);
+
+	return TRUE;
+}
+
+static void
+reuse_records (GVariant   *old_data,
+	       GHashTable *reused)
+{
+	g_autoptr (GVariant) keys = NULL;
+	g_autoptr (GVariant) records_data = NULL;
+	const CoverageRecord *records;
+	gsize i, n_records, n_keys;
+
+	keys = g_variant_get_child_value (old_data, 2);
+	records_data = g_variant_get_child_value (old_data, 3);
+	records = g_variant_get_fixed_array (records_data, &n_records,
+					     sizeof (CoverageRecord));
+	n_keys = g_variant_n_children (keys);
+
+	for (i = 0; i < n_records; i++) {
+		LayoutRecord record;
+		CoverageJob *job;
+		const gchar *key;
+
+		job = g_hash_table_lookup (reused,
+					   GUINT_TO_POINTER (records[i].layout));
+		if (!job || records[i].key >= n_keys)
+			continue;
+
+		g_variant_get_child (keys, records[i].key, "&s", &key);
+		record.codepoint = records[i].codepoint;
+		record.key = g_intern_string (key);
+		record.group = records[i].group;
+		record.level = records[i].level;
+		g_array_append_val (job->records, record);
+	}
+}
+
+static int
+compare_records (const CoverageRecord *a,
+		 const CoverageRecord *b)
+{
+	if (a->codepoint != b->codepoint)
+		return a->codepoint < b->codepoint ? -1 : 1;
+
+	return (a->layout > b->layout) - (a->layout < b->layout);
+}
+
+static GVariant *
+build_data (GPtrArray *jobs)
+{
+	g_autoptr (GHashTable) key_indexes = NULL;
+	g_autoptr (GArray) records = NULL;
+	GVariantBuilder layouts, keys;
+	guint i, j;
+
+	key_indexes = g_hash_table_new (NULL, NULL);
+	records = g_array_new (FALSE, FALSE, sizeof (CoverageRecord));
+	g_variant_builder_init (&layouts, G_VARIANT_TYPE ("a(st)"));
+	g_variant_builder_init (&keys, G_VARIANT_TYPE_STRING_ARRAY);
+
+	for (i = 0; i < jobs->len; i++) {
+		CoverageJob *job = jobs->pdata[i];
+
+		g_variant_builder_add (&layouts, "(st)", job->name, job->stamp);
+
+		for (j = 0; j < job->records->len; j++) {
+			LayoutRecord *record;
+			CoverageRecord entry = { 0, };
+			gpointer key_index;
+
+			record = &g_array_index (job->records, LayoutRecord, j);
+
+			/* Key names are interned, so pointers identify them */
+			if (!g_hash_table_lookup_extended (key_indexes, record->key,
+							   NULL, &key_index)) {
+				key_index = GUINT_TO_POINTER (g_hash_table_size (key_indexes));
+				g_hash_table_insert (key_indexes,
+						     (gpointer) record->key,
+						     key_index);
+				g_variant_builder_add (&keys, "s", record->key);
+			}
+
+			entry.codepoint = record->codepoint;
+			entry.layout = i;
+			entry.key = GPOINTER_TO_UINT (key_index);
+			entry.group = record->group;
+			entry.level = record->level;
+			g_array_append_val (records, entry);
+		}
+	}
+
+	g_array_sort (records, (GCompareFunc) compare_records);
+
+	return g_variant_ref_sink (g_variant_new ("(u@a(st)@as@a(uqqyy))",
+						  COVERAGE_VERSION,
+						  g_variant_builder_end (&layouts),
+						  g_variant_builder_end (&keys),
+						  g_variant_new_fixed_array (G_VARIANT_TYPE ("(uqqyy)"),
+									     records->data,
+									     records->len,
+									     sizeof (CoverageRecord))));
+}
+
+static GVariant *
+update_data (GVariant  *old_data,
+	     gboolean  *changed,
+	     GError   **error)
+{
+	TeclaRegistry *registry;
+	g_autoptr (GPtrArray) jobs = NULL;
+	g_autoptr (GPtrArray) pending = NULL;
+	g_autoptr (GHashTable) old_layouts = NULL;
+	g_autoptr (GHashTable) reused = NULL;
+	guint i, n_layouts;
+
+	registry = tecla_registry_get_default ();
+	n_layouts = MIN (tecla_registry_get_n_layouts (registry), G_MAXUINT16 + 1);
+
+	jobs = g_ptr_array_new_with_free_func ((GDestroyNotify) coverage_job_free);
+	pending = g_ptr_array_new ();
+	old_layouts = g_hash_table_new (g_str_hash, g_str_equal);
+	reused = g_hash_table_new (NULL, NULL);
+
+	if (old_data) {
+		g_autoptr (GVariant) layouts = NULL;
+
+		layouts = g_variant_get_child_value (old_data, 1);
+
+		for (i = 0; i < g_variant_n_children (layouts); i++) {
+			const gchar *name;
+
+			g_variant_get_child (layouts, i, "(&st)", &name, NULL);
+			g_hash_table_insert (old_layouts, (gpointer) name,
+					     GUINT_TO_POINTER (i));
+		}
+	}
+
+	for (i = 0; i < n_layouts; i++) {
+		const TeclaRegistryLayout *layout;
+		CoverageJob *job;
+		gpointer old_index;
+
+		layout = tecla_registry_get_layout (registry, i);
+
+		job = g_new0 (CoverageJob, 1);
+		job->name = g_strdup (layout->name);
+		job->stamp = tecla_model_get_layout_stamp (layout->name);
+		job->records = g_array_new (FALSE, FALSE, sizeof (LayoutRecord));
+		g_ptr_array_add (jobs, job);
+
+		/* Layouts whose XKB data did not change keep their records */
+		if (g_hash_table_lookup_extended (old_layouts, layout->name,
+						  NULL, &old_index)) {
+			g_autoptr (GVariant) layouts = NULL;
+			guint64 old_stamp;
+
+			layouts = g_variant_get_child_value (old_data, 1);
+			g_variant_get_child (layouts, GPOINTER_TO_UINT (old_index),
+					     "(&st)", NULL, &old_stamp);
+
+			if (old_stamp == job->stamp) {
+				g_hash_table_insert (reused, old_index, job);
+				continue;
+			}
+		}
+
+		g_ptr_array_add (pending, job);
+	}
+
+	*changed = pending->len > 0 ||
+		g_hash_table_size (old_layouts) != n_layouts;
+
+	if (!*changed && old_data)
+		return g_variant_ref (old_data);
+
+	if (old_data)
+		reuse_records (old_data, reused);
+
+	if (pending->len > 0) {
+		g_printerr ("Indexing %u of %u layouts…\n", pending->len, n_layouts);
+
+		if (!index_layouts (pending, error))
+			return NULL;
+	}
+
+	return build_data (jobs);
+}
+
+TeclaCoverage *
+tecla_coverage_new (GError **error)
+{
+	g_autoptr (TeclaCoverage) coverage = NULL;
+	g_autoptr (GVariant) old_data = NULL;
+	g_autofree gchar *path = NULL;
+	gboolean changed;
+
+	path = get_cache_path ();
+	old_data = load_data (path);
+
+	coverage = g_object_new (TECLA_TYPE_COVERAGE, NULL);
+	coverage->data = update_data (old_data, &changed, error);
+	if (!coverage->data)
+		return NULL;
+
+	if (changed)
+		save_data (path, coverage->data);
+
+	coverage->layouts = g_variant_get_child_value (coverage->data, 1);
+	coverage->keys = g_variant_get_child_value (coverage->data, 2);
+	coverage->records_data = g_variant_get_child_value (coverage->data, 3);
+	coverage->records = g_variant_get_fixed_array (coverage->records_data,
+						       &coverage->n_records,
+						       sizeof (CoverageRecord));
+
+	return g_steal_pointer (&coverage);
+}
+
+GArray *
+tecla_coverage_lookup (TeclaCoverage *coverage,
+		       gunichar       ch)
+{
+	GArray *entries;
+	gsize low = 0, high = coverage->n_records, n_layouts, n_keys, i;
+
+	entries = g_array_new (FALSE, FALSE, sizeof (TeclaCoverageEntry));
+	n_layouts = g_variant_n_children (coverage->layouts);
+	n_keys = g_variant_n_children (coverage->keys);
+
+	while (low < high) {
+		gsize mid = low + (high - low) / 2;
+
+		if (coverage->records[mid].codepoint < ch)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	for (i = low; i < coverage->n_records && coverage->records[i].codepoint == ch; i++) {
+		const CoverageRecord *record = &coverage->records[i];
+		TeclaCoverageEntry entry;
+
+		if (record->layout >= n_layouts || record->key >= n_keys)
+			continue;
+
+		g_variant_get_child (coverage->layouts, record->layout,
+				     "(&st)", &entry.layout, NULL);
+		g_variant_get_child (coverage->keys, record->key,
+				     "&s", &entry.key);
+		entry.group = record->group;
+		entry.level = record->level;
+		g_array_append_val (entries, entry);
+	}
+
+	return entries;
+}
@@ -0,0 +1,41 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <gio/gio.h>
+
+#pragma once
+
+typedef struct
+{
+	const gchar *layout;
+	const gchar *key;
+	int group;
+	int level;
+} TeclaCoverageEntry;
+
+#define TECLA_TYPE_COVERAGE (tecla_coverage_get_type ())
+G_DECLARE_FINAL_TYPE (TeclaCoverage, tecla_coverage,
+		      TECLA, COVERAGE,
+		      GObject)
+
+TeclaCoverage * tecla_coverage_new (GError **error);
+
+GArray * tecla_coverage_lookup (TeclaCoverage *coverage,
+				gunichar       ch);
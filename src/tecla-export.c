@@ -0,0 +1,420 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include "tecla-export.h"
+
+#include <gtk/gtk.h>
+#include <string.h>
+
+#include "tecla-model-private.h"
+#include "tecla-registry.h"
+
+/* Labels depend on the XKB data, so golden files are tied to the
+ * xkeyboard-config release they were exported from.
+ */
+#define XKB_VERSION_FILENAME "xkeyboard-config-version"
+
+typedef struct
+{
+	gchar *name;
+	GFile *file;
+	gint64 compile_time;
+	gint64 write_time;
+	gint64 label_time;
+	GError *error;
+} ExportJob;
+
+typedef struct
+{
+	GAsyncQueue *done;
+	gboolean check;
+	gint64 budget;
+} ExportData;
+
+static void
+export_job_free (ExportJob *job)
+{
+	g_free (job->name);
+	g_clear_object (&job->file);
+	g_clear_error (&job->error);
+	g_free (job);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ExportJob, export_job_free)
+
+static guint
+get_first_different_line (const gchar *a,
+			  gsize        a_len,
+			  const gchar *b,
+			  gsize        b_len)
+{
+	gsize i;
+	guint line = 1;
+
+	for (i = 0; i < MIN (a_len, b_len) && a[i] == b[i]; i++) {
+		if (a[i] == '\n')
+			line++;
+	}
+
+	return line;
+}
+
+static void
+check_labels (ExportJob  *job,
+	      TeclaModel *model)
+{
+	g_autoptr (GOutputStream) stream = NULL;
+	g_autoptr (GBytes) labels = NULL;
+	g_autofree gchar *golden = NULL;
+	const gchar *data;
+	gsize golden_len, len;
+	gint64 start;
+
+	/* Serializing computes every label of every level */
+	start = g_get_monotonic_time ();
+	stream = g_memory_output_stream_new_resizable ();
+	if (!tecla_model_serialize (model, TECLA_MODEL_FORMAT_TSV,
+				    stream, &job->error) ||
+	    !g_output_stream_close (stream, NULL, &job->error))
+		return;
+	job->label_time = g_get_monotonic_time () - start;
+
+	labels = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (stream));
+
+	if (!g_file_load_contents (job->file, NULL, &golden, &golden_len,
+				   NULL, &job->error))
+		return;
+
+	data = g_bytes_get_data (labels, &len);
+	if (len != golden_len || memcmp (data, golden, len) != 0) {
+		g_set_error (&job->error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     "Labels differ from %s at line %u",
+			     g_file_peek_path (job->file),
+			     get_first_different_line (data, len,
+						       golden, golden_len));
+	}
+}
+
+static void
+check_budget (ExportJob *job,
+	      gint64     budget)
+{
+	if (budget <= 0)
+		return;
+
+	if (job->compile_time > budget) {
+		g_set_error (&job->error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+			     "Compile took %.2f ms, over the %.2f ms budget",
+			     job->compile_time / 1000.0, budget / 1000.0);
+	} else if (job->label_time > budget) {
+		g_set_error (&job->error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+			     "Labels took %.2f ms, over the %.2f ms budget",
+			     job->label_time / 1000.0, budget / 1000.0);
+	}
+}
+
+static void
+export_layout (ExportJob  *job,
+	       ExportData *data)
+{
+	g_autoptr (TeclaModel) model = NULL;
+	g_autoptr (GFileOutputStream) stream = NULL;
+	gint64 start;
+
+	/* Compiled afresh, so neither shared models nor the model cache
+	 * may hide changes to labels or to compile times.
+	 */
+	start = g_get_monotonic_time ();
+	model = tecla_model_compile_layout_name (job->name);
+	job->compile_time = g_get_monotonic_time () - start;
+
+	if (!model) {
+		g_set_error (&job->error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     "Could not compile keymap");
+		goto out;
+	}
+
+	if (data->check) {
+		check_labels (job, model);
+		if (!job->error)
+			check_budget (job, data->budget);
+		goto out;
+	}
+
+	start = g_get_monotonic_time ();
+	stream = g_file_replace (job->file, NULL, FALSE,
+				 G_FILE_CREATE_REPLACE_DESTINATION,
+				 NULL, &job->error);
+	if (!stream)
+		goto out;
+
+	if (!tecla_model_serialize (model, TECLA_MODEL_FORMAT_TSV,
+				    G_OUTPUT_STREAM (stream), &job->error))
+		goto out;
+
+	g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &job->error);
+	job->write_time = g_get_monotonic_time () - start;
+
+ out:
+	g_async_queue_push (data->done, job);
+}
+
+static int
+compare_names (gconstpointer a,
+	       gconstpointer b)
+{
+	return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+static GPtrArray *
+list_golden_layouts (GFile   *dir,
+		     GError **error)
+{
+	g_autoptr (GPtrArray) names = NULL;
+	g_autoptr (GDir) gdir = NULL;
+	const gchar *filename;
+
+	gdir = g_dir_open (g_file_peek_path (dir), 0, error);
+	if (!gdir)
+		return NULL;
+
+	names = g_ptr_array_new_with_free_func (g_free);
+
+	while ((filename = g_dir_read_name (gdir)) != NULL) {
+		if (g_str_has_suffix (filename, ".tsv")) {
+			g_ptr_array_add (names,
+					 g_strndup (filename,
+						    strlen (filename) - strlen (".tsv")));
+		}
+	}
+
+	/* Sorted, so shards are stable between runs */
+	g_ptr_array_sort (names, compare_names);
+
+	return g_steal_pointer (&names);
+}
+
+static GPtrArray *
+list_registry_layouts (GError **error)
+{
+	TeclaRegistry *registry;
+	GPtrArray *names;
+	guint i;
+
+	registry = tecla_registry_get_default ();
+	if (tecla_registry_get_n_layouts (registry) == 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     "Could not parse the XKB registry");
+		return NULL;
+	}
+
+	names = g_ptr_array_new_with_free_func (g_free);
+
+	for (i = 0; i < tecla_registry_get_n_layouts (registry); i++) {
+		const TeclaRegistryLayout *layout;
+
+		layout = tecla_registry_get_layout (registry, i);
+		g_ptr_array_add (names, g_strdup (layout->name));
+	}
+
+	return names;
+}
+
+static gboolean
+check_xkb_version (GFile   *dir,
+		   GError **error)
+{
+	g_autoptr (GFile) file = NULL;
+	g_autofree gchar *version = NULL;
+
+	file = g_file_get_child (dir, XKB_VERSION_FILENAME);
+	if (!g_file_load_contents (file, NULL, &version, NULL, NULL, error))
+		return FALSE;
+
+	g_strstrip (version);
+
+#ifdef XKEYBOARD_CONFIG_VERSION
+	if (strcmp (version, XKEYBOARD_CONFIG_VERSION) == 0)
+		return TRUE;
+
+	g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+		     "Golden files are for xkeyboard-config %s, not %s",
+		     version, XKEYBOARD_CONFIG_VERSION);
+#else
+	g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+		     "Golden files are for xkeyboard-config %s, the version "
+		     "in use is unknown", version);
+#endif
+
+	return FALSE;
+}
+
+static gboolean
+write_xkb_version (GFile   *dir,
+		   GError **error)
+{
+#ifdef XKEYBOARD_CONFIG_VERSION
+	g_autoptr (GFile) file = NULL;
+
+	file = g_file_get_child (dir, XKB_VERSION_FILENAME);
+
+	return g_file_replace_contents (file, XKEYBOARD_CONFIG_VERSION "\n",
+					strlen (XKEYBOARD_CONFIG_VERSION "\n"),
+					NULL, FALSE,
+					G_FILE_CREATE_REPLACE_DESTINATION,
+					NULL, NULL, error);
+#else
+	return TRUE;
+#endif
+}
+
+static gboolean
+run_jobs (const gchar  *directory,
+	  gboolean      check,
+	  guint         shard,
+	  guint         n_shards,
+	  gint64        budget,
+	  GError      **error)
+{
+	g_autoptr (GAsyncQueue) done = NULL;
+	g_autoptr (GFile) dir = NULL;
+	g_autoptr (GError) dir_error = NULL;
+	g_autoptr (GPtrArray) names = NULL;
+	GThreadPool *pool;
+	ExportData data;
+	guint n_jobs = 0, n_failed = 0, i;
+	int n_threads;
+	gint64 start;
+
+	g_return_val_if_fail (shard < n_shards, FALSE);
+
+	dir = g_file_new_for_commandline_arg (directory);
+	if (!check &&
+	    !g_file_make_directory_with_parents (dir, NULL, &dir_error) &&
+	    !g_error_matches (dir_error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
+		g_propagate_error (error, g_steal_pointer (&dir_error));
+		return FALSE;
+	}
+
+	if (check && !check_xkb_version (dir, error))
+		return FALSE;
+	else if (!check && !write_xkb_version (dir, error))
+		return FALSE;
+
+	/* Checks cover the layouts with a golden file, exports all of them */
+	if (check)
+		names = list_golden_layouts (dir, error);
+	else
+		names = list_registry_layouts (error);
+	if (!names)
+		return FALSE;
+
+	done = g_async_queue_new ();
+	data.done = done;
+	data.check = check;
+	data.budget = budget;
+	pool = g_thread_pool_new ((GFunc) export_layout, &data,
+				  (int) g_get_num_processors (), TRUE,
+				  error);
+	if (!pool)
+		return FALSE;
+
+	start = g_get_monotonic_time ();
+
+	for (i = 0; i < names->len; i++) {
+		g_autofree gchar *filename = NULL;
+		ExportJob *job;
+
+		/* Interleaved, so shards get a similar mix of layouts */
+		if (i % n_shards != shard)
+			continue;
+
+		job = g_new0 (ExportJob, 1);
+		job->name = g_strdup (names->pdata[i]);
+
+		filename = g_strconcat (job->name, ".tsv", NULL);
+		job->file = g_file_get_child (dir, filename);
+
+		g_thread_pool_push (pool, job, NULL);
+		n_jobs++;
+	}
+
+	n_threads = g_thread_pool_get_max_threads (pool);
+
+	for (i = 0; i < n_jobs; i++) {
+		g_autoptr (ExportJob) job = NULL;
+
+		job = g_async_queue_pop (done);
+
+		if (job->error) {
+			g_printerr ("[%u/%u] %s: %s\n", i + 1, n_jobs,
+				    job->name, job->error->message);
+			n_failed++;
+		} else if (check) {
+			g_print ("[%u/%u] %s: compile %.2f ms, labels %.2f ms\n",
+				 i + 1, n_jobs, job->name,
+				 job->compile_time / 1000.0,
+				 job->label_time / 1000.0);
+		} else {
+			g_print ("[%u/%u] %s: compile %.2f ms, write %.2f ms\n",
+				 i + 1, n_jobs, job->name,
+				 job->compile_time / 1000.0,
+				 job->write_time / 1000.0);
+		}
+	}
+
+	g_thread_pool_free (pool, FALSE, TRUE);
+
+	g_print ("%s %u layouts in %.2f s using %d threads\n",
+		 check ? "Checked" : "Exported",
+		 n_jobs - n_failed,
+		 (g_get_monotonic_time () - start) / (double) G_USEC_PER_SEC,
+		 n_threads);
+
+	if (n_failed > 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     "%u layouts failed to %s", n_failed,
+			     check ? "check" : "export");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+gboolean
+tecla_export_all_layouts (const gchar  *directory,
+			  guint         shard,
+			  guint         n_shards,
+			  GError      **error)
+{
+	return run_jobs (directory, FALSE, shard, n_shards, 0, error);
+}
+
+gboolean
+tecla_export_check_all_layouts (const gchar  *directory,
+				guint         shard,
+				guint         n_shards,
+				gint64        budget,
+				GError      **error)
+{
+	return run_jobs (directory, TRUE, shard, n_shards, budget, error);
+}
@@ -0,0 +1,411 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <gtk/gtk.h>
+#include <string.h>
+
+#include "tecla-gallery.h"
+
+#include "tecla-registry.h"
+#include "tecla-thumbnail.h"
+
+#define THUMBNAIL_WIDTH 240
+#define THUMBNAIL_HEIGHT 80
+
+/* Items on each side of a bound item rendered ahead of time */
+#define N_PREFETCH 12
+
+struct _TeclaGallery
+{
+	GtkWidget parent_instance;
+	GtkWidget *search_entry;
+	GtkWidget *grid_view;
+
+	TeclaRegistry *registry;
+	GtkFilter *filter;
+	GtkSorter *sorter;
+	GListModel *layouts;
+	GHashTable *matches; /* name -> rank + 1 */
+	gchar *search;
+
+	GHashTable *prefetched;
+	GCancellable *cancellable;
+};
+
+typedef struct
+{
+	GWeakRef gallery;
+	gchar *name;
+} Prefetch;
+
+G_DEFINE_TYPE (TeclaGallery, tecla_gallery, GTK_TYPE_WIDGET)
+
+enum
+{
+	LAYOUT_ACTIVATED,
+	N_SIGNALS,
+};
+
+static guint signals[N_SIGNALS] = { 0, };
+
+static void
+tecla_gallery_dispose (GObject *object)
+{
+	TeclaGallery *gallery = TECLA_GALLERY (object);
+
+	g_cancellable_cancel (gallery->cancellable);
+	gtk_widget_dispose_template (GTK_WIDGET (gallery), TECLA_TYPE_GALLERY);
+
+	G_OBJECT_CLASS (tecla_gallery_parent_class)->dispose (object);
+}
+
+static void
+tecla_gallery_finalize (GObject *object)
+{
+	TeclaGallery *gallery = TECLA_GALLERY (object);
+
+	g_clear_object (&gallery->layouts);
+	g_clear_object (&gallery->filter);
+	g_clear_object (&gallery->sorter);
+	g_clear_object (&gallery->cancellable);
+	g_hash_table_unref (gallery->matches);
+	g_hash_table_unref (gallery->prefetched);
+	g_free (gallery->search);
+
+	G_OBJECT_CLASS (tecla_gallery_parent_class)->finalize (object);
+}
+
+static void
+search_changed_cb (GtkSearchEntry *entry,
+		   TeclaGallery   *gallery)
+{
+	g_autofree gchar *search = NULL;
+	g_autoptr (GPtrArray) results = NULL;
+	GtkFilterChange change = GTK_FILTER_CHANGE_DIFFERENT;
+	guint i;
+
+	search = g_utf8_casefold (gtk_editable_get_text (GTK_EDITABLE (entry)), -1);
+	results = tecla_registry_search (gallery->registry, search, 0);
+
+	g_hash_table_remove_all (gallery->matches);
+
+	for (i = 0; i < results->len; i++) {
+		const TeclaRegistryLayout *layout = results->pdata[i];
+
+		g_hash_table_insert (gallery->matches, (gpointer) layout->name,
+				     GUINT_TO_POINTER (i + 1));
+	}
+
+	if (gallery->search && strstr (search, gallery->search))
+		change = GTK_FILTER_CHANGE_MORE_STRICT;
+	else if (gallery->search && strstr (gallery->search, search))
+		change = GTK_FILTER_CHANGE_LESS_STRICT;
+
+	g_free (gallery->search);
+	gallery->search = g_steal_pointer (&search);
+	gtk_filter_changed (gallery->filter, change);
+	gtk_sorter_changed (gallery->sorter, GTK_SORTER_CHANGE_DIFFERENT);
+}
+
+static void
+grid_view_activate_cb (GtkGridView  *grid_view,
+		       guint         position,
+		       TeclaGallery *gallery)
+{
+	g_autoptr (GtkStringObject) item = NULL;
+
+	item = g_list_model_get_item (gallery->layouts, position);
+	if (!item)
+		return;
+
+	g_signal_emit (gallery, signals[LAYOUT_ACTIVATED], 0,
+		       gtk_string_object_get_string (item));
+}
+
+static void
+tecla_gallery_class_init (TeclaGalleryClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
+
+	object_class->dispose = tecla_gallery_dispose;
+	object_class->finalize = tecla_gallery_finalize;
+
+	signals[LAYOUT_ACTIVATED] =
+		g_signal_new ("layout-activated",
+			      G_OBJECT_CLASS_TYPE (object_class),
+			      G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, NULL,
+			      G_TYPE_NONE,
+			      1, G_TYPE_STRING);
+
+	gtk_widget_class_set_template_from_resource (widget_class, "/org/gnome/tecla/tecla-gallery.ui");
+	gtk_widget_class_bind_template_child (widget_class, TeclaGallery, search_entry);
+	gtk_widget_class_bind_template_child (widget_class, TeclaGallery, grid_view);
+	gtk_widget_class_bind_template_callback (widget_class, search_changed_cb);
+	gtk_widget_class_bind_template_callback (widget_class, grid_view_activate_cb);
+	gtk_widget_class_set_layout_manager_type (widget_class, GTK_TYPE_BIN_LAYOUT);
+}
+
+static gboolean
+match_layout (GtkStringObject *item,
+	      TeclaGallery    *gallery)
+{
+	if (!gallery->search || !*gallery->search)
+		return TRUE;
+
+	return g_hash_table_contains (gallery->matches,
+				      gtk_string_object_get_string (item));
+}
+
+static int
+compare_layouts (GtkStringObject *a,
+		 GtkStringObject *b,
+		 TeclaGallery    *gallery)
+{
+	guint rank_a, rank_b;
+
+	/* Best matches first while searching, registry order otherwise */
+	rank_a = GPOINTER_TO_UINT (g_hash_table_lookup (gallery->matches,
+							gtk_string_object_get_string (a)));
+	rank_b = GPOINTER_TO_UINT (g_hash_table_lookup (gallery->matches,
+							gtk_string_object_get_string (b)));
+
+	return (rank_a > rank_b) - (rank_a < rank_b);
+}
+
+static void
+thumbnail_rendered_cb (GObject      *source,
+		       GAsyncResult *result,
+		       gpointer      user_data)
+{
+	g_autoptr (GtkPicture) picture = user_data;
+	g_autoptr (TeclaThumbnail) thumbnail = NULL;
+	g_autoptr (GdkTexture) texture = NULL;
+	g_autoptr (GError) error = NULL;
+
+	thumbnail = tecla_thumbnail_render_finish (result, &error);
+	if (thumbnail)
+		texture = tecla_thumbnail_create_texture (thumbnail, &error);
+
+	if (!texture) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_debug ("Could not render thumbnail: %s", error->message);
+		return;
+	}
+
+	gtk_picture_set_paintable (picture, GDK_PAINTABLE (texture));
+}
+
+static void
+thumbnail_prefetched_cb (GObject      *source,
+			 GAsyncResult *result,
+			 gpointer      user_data)
+{
+	Prefetch *prefetch = user_data;
+	g_autoptr (TeclaThumbnail) thumbnail = NULL;
+	g_autoptr (TeclaGallery) gallery = NULL;
+
+	thumbnail = tecla_thumbnail_render_finish (result, NULL);
+
+	/* The thumbnail is now cheap to load from the cache, forget about it
+	 * so the set only holds prefetches in flight.
+	 */
+	gallery = g_weak_ref_get (&prefetch->gallery);
+	if (gallery)
+		g_hash_table_remove (gallery->prefetched, prefetch->name);
+
+	g_weak_ref_clear (&prefetch->gallery);
+	g_free (prefetch->name);
+	g_free (prefetch);
+}
+
+static void
+prefetch_neighbours (TeclaGallery *gallery,
+		     guint         position)
+{
+	GListModel *model = gallery->layouts;
+	guint i, start, end;
+	int scale;
+
+	scale = gtk_widget_get_scale_factor (GTK_WIDGET (gallery));
+	start = position > N_PREFETCH ? position - N_PREFETCH : 0;
+	end = MIN (position + N_PREFETCH + 1, g_list_model_get_n_items (model));
+
+	for (i = start; i < end; i++) {
+		g_autoptr (GtkStringObject) item = NULL;
+		const gchar *name;
+		Prefetch *prefetch;
+
+		item = g_list_model_get_item (model, i);
+		name = gtk_string_object_get_string (item);
+
+		if (i == position ||
+		    !g_hash_table_add (gallery->prefetched, g_strdup (name)))
+			continue;
+
+		/* Only warms up the thumbnail cache, results are dropped */
+		prefetch = g_new0 (Prefetch, 1);
+		g_weak_ref_init (&prefetch->gallery, gallery);
+		prefetch->name = g_strdup (name);
+		tecla_thumbnail_render_async (name,
+					      THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT,
+					      scale, G_PRIORITY_LOW,
+					      gallery->cancellable,
+					      thumbnail_prefetched_cb,
+					      prefetch);
+	}
+}
+
+static void
+setup_item_cb (GtkSignalListItemFactory *factory,
+	       GtkListItem              *list_item,
+	       TeclaGallery             *gallery)
+{
+	GtkWidget *box, *picture, *label;
+
+	box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 6);
+
+	picture = gtk_picture_new ();
+	gtk_picture_set_content_fit (GTK_PICTURE (picture),
+				     GTK_CONTENT_FIT_CONTAIN);
+	gtk_widget_set_size_request (picture, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
+	gtk_box_append (GTK_BOX (box), picture);
+
+	label = gtk_label_new (NULL);
+	gtk_label_set_ellipsize (GTK_LABEL (label), PANGO_ELLIPSIZE_END);
+	gtk_label_set_max_width_chars (GTK_LABEL (label), 30);
+	gtk_box_append (GTK_BOX (box), label);
+
+	gtk_list_item_set_child (list_item, box);
+}
+
+static void
+bind_item_cb (GtkSignalListItemFactory *factory,
+	      GtkListItem              *list_item,
+	      TeclaGallery             *gallery)
+{
+	const TeclaRegistryLayout *layout;
+	GtkStringObject *item;
+	GtkWidget *box, *picture, *label;
+	GCancellable *cancellable;
+	const gchar *name, *description = NULL;
+
+	item = gtk_list_item_get_item (list_item);
+	name = gtk_string_object_get_string (item);
+	layout = tecla_registry_lookup (gallery->registry, name);
+	if (layout && *layout->description)
+		description = layout->description;
+
+	box = gtk_list_item_get_child (list_item);
+	picture = gtk_widget_get_first_child (box);
+	label = gtk_widget_get_next_sibling (picture);
+
+	gtk_label_set_text (GTK_LABEL (label), description ? description : name);
+	gtk_widget_set_tooltip_text (box, name);
+
+	/* Models are only compiled while rendering, on a worker thread */
+	cancellable = g_cancellable_new ();
+	g_object_set_data_full (G_OBJECT (list_item), "cancellable",
+				cancellable, g_object_unref);
+	tecla_thumbnail_render_async (name, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT,
+				      gtk_widget_get_scale_factor (GTK_WIDGET (gallery)),
+				      G_PRIORITY_DEFAULT, cancellable,
+				      thumbnail_rendered_cb,
+				      g_object_ref (picture));
+
+	prefetch_neighbours (gallery, gtk_list_item_get_position (list_item));
+}
+
+static void
+unbind_item_cb (GtkSignalListItemFactory *factory,
+		GtkListItem              *list_item,
+		TeclaGallery             *gallery)
+{
+	GCancellable *cancellable;
+	GtkWidget *box;
+
+	cancellable = g_object_get_data (G_OBJECT (list_item), "cancellable");
+	if (cancellable)
+		g_cancellable_cancel (cancellable);
+	g_object_set_data (G_OBJECT (list_item), "cancellable", NULL);
+
+	box = gtk_list_item_get_child (list_item);
+	gtk_picture_set_paintable (GTK_PICTURE (gtk_widget_get_first_child (box)),
+				   NULL);
+}
+
+static void
+tecla_gallery_init (TeclaGallery *gallery)
+{
+	g_autoptr (GtkStringList) list = NULL;
+	g_autoptr (GtkListItemFactory) factory = NULL;
+	GtkFilterListModel *filtered;
+	GtkSelectionModel *selection;
+	guint i;
+
+	gtk_widget_init_template (GTK_WIDGET (gallery));
+
+	gallery->registry = tecla_registry_get_default ();
+	gallery->matches = g_hash_table_new (g_str_hash, g_str_equal);
+	gallery->prefetched = g_hash_table_new_full (g_str_hash, g_str_equal,
+						     g_free, NULL);
+	gallery->cancellable = g_cancellable_new ();
+
+	list = gtk_string_list_new (NULL);
+	for (i = 0; i < tecla_registry_get_n_layouts (gallery->registry); i++) {
+		gtk_string_list_append (list,
+					tecla_registry_get_layout (gallery->registry, i)->name);
+	}
+
+	gallery->filter =
+		GTK_FILTER (gtk_custom_filter_new ((GtkCustomFilterFunc) match_layout,
+						   gallery, NULL));
+	gallery->sorter =
+		GTK_SORTER (gtk_custom_sorter_new ((GCompareDataFunc) compare_layouts,
+						   gallery, NULL));
+	filtered = gtk_filter_list_model_new (G_LIST_MODEL (g_steal_pointer (&list)),
+					      g_object_ref (gallery->filter));
+	gallery->layouts =
+		G_LIST_MODEL (gtk_sort_list_model_new (G_LIST_MODEL (filtered),
+						       g_object_ref (gallery->sorter)));
+
+	factory = gtk_signal_list_item_factory_new ();
+	g_signal_connect (factory, "setup",
+			  G_CALLBACK (setup_item_cb), gallery);
+	g_signal_connect (factory, "bind",
+			  G_CALLBACK (bind_item_cb), gallery);
+	g_signal_connect (factory, "unbind",
+			  G_CALLBACK (unbind_item_cb), gallery);
+
+	selection = GTK_SELECTION_MODEL (gtk_no_selection_new (g_object_ref (gallery->layouts)));
+	gtk_grid_view_set_model (GTK_GRID_VIEW (gallery->grid_view), selection);
+	gtk_grid_view_set_factory (GTK_GRID_VIEW (gallery->grid_view), factory);
+	g_object_unref (selection);
+
+	gtk_search_entry_set_key_capture_widget (GTK_SEARCH_ENTRY (gallery->search_entry),
+						 GTK_WIDGET (gallery));
+}
+
+GtkWidget *
+tecla_gallery_new (void)
+{
+	return g_object_new (TECLA_TYPE_GALLERY, NULL);
+}
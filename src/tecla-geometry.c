@@ -0,0 +1,83 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include "tecla-geometry.h"
+
+#include "pc105.h"
+
+/**
+ * tecla_geometry_get_n_rows:
+ *
+ * Returns: the number of key rows of the pc105 keyboard shown by tecla
+ */
+guint
+tecla_geometry_get_n_rows (void)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (pc105_layout.rows); i++) {
+		if (!pc105_layout.rows[i].keys[0].name)
+			break;
+	}
+
+	return i;
+}
+
+/**
+ * tecla_geometry_get_key:
+ * @row: a row, from the top
+ * @index: a key in the row, from the left
+ * @name: (out) (optional) (transfer none): the XKB key name
+ * @width: (out) (optional): the key width, in key units
+ * @height: (out) (optional): the key height, in key units. Keys spanning
+ *   several rows are listed in each of them, with a negative height in
+ *   all but their top row
+ *
+ * Returns: %FALSE if there is no such key
+ */
+gboolean
+tecla_geometry_get_key (guint         row,
+			guint         index,
+			const gchar **name,
+			double       *width,
+			double       *height)
+{
+	const TeclaLayoutKey *key;
+
+	if (row >= G_N_ELEMENTS (pc105_layout.rows) ||
+	    index >= G_N_ELEMENTS (pc105_layout.rows[row].keys))
+		return FALSE;
+
+	key = &pc105_layout.rows[row].keys[index];
+	if (!key->name)
+		return FALSE;
+
+	/* Unset sizes default to one key unit, as in TeclaView */
+	if (name)
+		*name = key->name;
+	if (width)
+		*width = MAX (key->width, 1);
+	if (height)
+		*height = key->height < 0 ? key->height : MAX (key->height, 1);
+
+	return TRUE;
+}
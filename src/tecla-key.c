@@ -18,10 +18,15 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
  */
 
+#include "config.h"
+
 #include "tecla-key.h"
 
 #include <math.h>
 
+#include "tecla-profiler.h"
+#include "tecla-stats.h"
+
 struct _TeclaKey
 {
 	GtkWidget parent_class;
@@ -112,6 +117,10 @@ tecla_key_snapshot (GtkWidget *widget,
 	int width, height, x, y;
 	float scale;
 
+	TECLA_PROFILER_BEGIN_MARK;
+
+	tecla_stats_increment (TECLA_STATS_KEY_SNAPSHOTS);
+
 	layout = gtk_widget_create_pango_layout (widget, key->label);
 	gtk_widget_get_color (widget, &color);
 
@@ -136,6 +145,9 @@ tecla_key_snapshot (GtkWidget *widget,
 	gtk_snapshot_append_layout (snapshot,
 				    layout,
 				    &color);
+
+	TECLA_PROFILER_END_MARK ("Key snapshot", "%s",
+				 key->name ? key->name : "");
 }
 
 static void
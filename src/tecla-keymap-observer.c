@@ -18,15 +18,20 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
  */
 
+#include "config.h"
+
 #include "tecla-keymap-observer.h"
 
 #include <gdk/gdk.h>
+#include <string.h>
 
 #ifdef GDK_WINDOWING_WAYLAND
 #include <gdk/wayland/gdkwayland.h>
 #include <wayland-client.h>
 #endif
 
+#include "tecla-profiler.h"
+#include "tecla-stats.h"
 #include "tecla-util.h"
 
 struct _TeclaKeymapObserver
@@ -40,6 +45,7 @@ struct _TeclaKeymapObserver
 #endif
 
 	struct xkb_keymap *xkb_keymap;
+	GBytes *keymap_data;
 	uint32_t group;
 };
 
@@ -55,6 +61,48 @@ static GParamSpec *props[N_PROPS] = { 0, };
 
 G_DEFINE_TYPE (TeclaKeymapObserver, tecla_keymap_observer, G_TYPE_OBJECT)
 
+/* Far larger than any real keymap, compiling these could stall the UI */
+#define MAX_KEYMAP_SIZE (1024 * 1024)
+
+GBytes *
+tecla_keymap_observer_read_keymap (const gchar *contents,
+				   gsize        size)
+{
+	const gchar *nul;
+
+	if (size > MAX_KEYMAP_SIZE)
+		return NULL;
+
+	/* The keymap is NUL terminated, but do not trust it to be */
+	nul = memchr (contents, '\0', size);
+
+	return g_bytes_new (contents, nul ? (gsize) (nul - contents) : size);
+}
+
+struct xkb_keymap *
+tecla_keymap_observer_compile_keymap (GBytes *keymap_data)
+{
+	struct xkb_context *xkb_context;
+	struct xkb_keymap *xkb_keymap;
+	const gchar *contents;
+	gsize length;
+
+	contents = g_bytes_get_data (keymap_data, &length);
+
+	TECLA_PROFILER_BEGIN_MARK;
+
+	xkb_context = tecla_util_create_xkb_context ();
+	xkb_keymap = xkb_keymap_new_from_buffer (xkb_context,
+						 contents, length,
+						 XKB_KEYMAP_FORMAT_TEXT_V1,
+						 XKB_KEYMAP_COMPILE_NO_FLAGS);
+	xkb_context_unref (xkb_context);
+
+	TECLA_PROFILER_END_MARK ("Compile keymap", "%u bytes", (guint) length);
+
+	return xkb_keymap;
+}
+
 #ifdef GDK_WINDOWING_WAYLAND
 
 static void
@@ -71,23 +119,47 @@ keyboard_keymap (void               *data,
 {
 	TeclaKeymapObserver *observer = data;
 	g_autoptr (GMappedFile) mapped_file = NULL;
-	struct xkb_context *xkb_context;
+	g_autoptr (GBytes) keymap_data = NULL;
+	struct xkb_keymap *xkb_keymap;
+
+	if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1 ||
+	    size > MAX_KEYMAP_SIZE) {
+		close (fd);
+		return;
+	}
 
+	/* The mapping stays valid after closing the fd */
 	mapped_file = g_mapped_file_new_from_fd (fd, FALSE, NULL);
+	close (fd);
 	if (!mapped_file)
 		return;
 
-	if (observer->xkb_keymap)
-		xkb_keymap_unref (observer->xkb_keymap);
+	keymap_data =
+		tecla_keymap_observer_read_keymap (g_mapped_file_get_contents (mapped_file),
+						   MIN (g_mapped_file_get_length (mapped_file), size));
 
-	xkb_context = tecla_util_create_xkb_context ();
-	observer->xkb_keymap =
-		xkb_keymap_new_from_string (xkb_context,
-					    g_mapped_file_get_contents (mapped_file),
-					    format,
-					    XKB_KEYMAP_COMPILE_NO_FLAGS);
-	xkb_context_unref (xkb_context);
-	close (fd);
+	/* Compositors may send the same keymap again, avoid recompiling it */
+	if (observer->keymap_data &&
+	    g_bytes_equal (observer->keymap_data, keymap_data)) {
+		tecla_stats_increment (TECLA_STATS_KEYMAP_SKIPS);
+		return;
+	}
+
+	tecla_stats_increment (TECLA_STATS_KEYMAP_COMPILES);
+
+	xkb_keymap = tecla_keymap_observer_compile_keymap (keymap_data);
+
+	/* Keep showing the previous keymap */
+	if (!xkb_keymap) {
+		g_warning ("Could not compile the keymap sent by the compositor");
+		return;
+	}
+
+	g_clear_pointer (&observer->keymap_data, g_bytes_unref);
+	observer->keymap_data = g_steal_pointer (&keymap_data);
+
+	g_clear_pointer (&observer->xkb_keymap, xkb_keymap_unref);
+	observer->xkb_keymap = xkb_keymap;
 
 	g_object_notify (G_OBJECT (observer), "keymap");
 }
@@ -192,6 +264,7 @@ tecla_keymap_observer_finalize (GObject *object)
 #endif
 
 	g_clear_pointer (&observer->xkb_keymap, xkb_keymap_unref);
+	g_clear_pointer (&observer->keymap_data, g_bytes_unref);
 
 	G_OBJECT_CLASS (tecla_keymap_observer_parent_class)->finalize (object);
 }
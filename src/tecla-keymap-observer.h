@@ -33,3 +33,9 @@ TeclaKeymapObserver * tecla_keymap_observer_new (void);
 struct xkb_keymap * tecla_keymap_observer_get_keymap (TeclaKeymapObserver *observer);
 
 int tecla_keymap_observer_get_group (TeclaKeymapObserver *observer);
+
+/* Keymap ingestion as done for wl_keyboard.keymap, exposed for fuzzing */
+GBytes * tecla_keymap_observer_read_keymap (const gchar *contents,
+					    gsize        size);
+
+struct xkb_keymap * tecla_keymap_observer_compile_keymap (GBytes *keymap_data);
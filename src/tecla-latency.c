@@ -0,0 +1,313 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tecla-latency.h"
+
+#include <glib/gi18n.h>
+
+/* Events older than this are assumed to come from another clock */
+#define MAX_LATENCY (10 * G_USEC_PER_SEC)
+
+typedef struct
+{
+	GdkFrameClock *frame_clock;
+	gint64 event_time;
+	gint64 frame_counter; /* Frame showing the event, or -1 */
+} PendingEvent;
+
+struct _TeclaLatencyProbe
+{
+	GObject parent_instance;
+	GArray *latencies; /* gint64, in microseconds */
+	GQueue pending; /* PendingEvent* */
+	GPtrArray *frame_clocks;
+	guint n_discarded;
+	gint64 event_time; /* Key press not shown yet, or 0 */
+};
+
+G_DEFINE_TYPE (TeclaLatencyProbe, tecla_latency_probe, G_TYPE_OBJECT)
+
+static void after_paint_cb (GdkFrameClock     *frame_clock,
+			    TeclaLatencyProbe *probe);
+
+static void
+pending_event_free (PendingEvent *event)
+{
+	g_object_unref (event->frame_clock);
+	g_free (event);
+}
+
+static void
+tecla_latency_probe_finalize (GObject *object)
+{
+	TeclaLatencyProbe *probe = TECLA_LATENCY_PROBE (object);
+	guint i;
+
+	for (i = 0; i < probe->frame_clocks->len; i++) {
+		g_signal_handlers_disconnect_by_func (probe->frame_clocks->pdata[i],
+						      after_paint_cb, probe);
+	}
+
+	g_ptr_array_unref (probe->frame_clocks);
+	g_queue_clear_full (&probe->pending, (GDestroyNotify) pending_event_free);
+	g_array_unref (probe->latencies);
+
+	G_OBJECT_CLASS (tecla_latency_probe_parent_class)->finalize (object);
+}
+
+static void
+tecla_latency_probe_class_init (TeclaLatencyProbeClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = tecla_latency_probe_finalize;
+}
+
+static void
+tecla_latency_probe_init (TeclaLatencyProbe *probe)
+{
+	probe->latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+	probe->frame_clocks = g_ptr_array_new_with_free_func (g_object_unref);
+	g_queue_init (&probe->pending);
+}
+
+TeclaLatencyProbe *
+tecla_latency_probe_new (void)
+{
+	return g_object_new (TECLA_TYPE_LATENCY_PROBE, NULL);
+}
+
+static gint64
+get_frame_time (GdkFrameTimings *timings)
+{
+	gint64 time;
+
+	time = gdk_frame_timings_get_presentation_time (timings);
+	if (time == 0)
+		time = gdk_frame_timings_get_predicted_presentation_time (timings);
+
+	return time;
+}
+
+static gboolean
+resolve_event (TeclaLatencyProbe *probe,
+	       PendingEvent      *event)
+{
+	GdkFrameTimings *timings;
+	gint64 latency;
+
+	timings = gdk_frame_clock_get_timings (event->frame_clock,
+					       event->frame_counter);
+
+	/* Timings only stay around for a few frames */
+	if (!timings) {
+		probe->n_discarded++;
+		return TRUE;
+	}
+
+	if (!gdk_frame_timings_get_complete (timings))
+		return FALSE;
+
+	latency = get_frame_time (timings) - event->event_time;
+
+	if (latency >= 0 && latency < MAX_LATENCY)
+		g_array_append_val (probe->latencies, latency);
+	else
+		probe->n_discarded++;
+
+	return TRUE;
+}
+
+static void
+after_paint_cb (GdkFrameClock     *frame_clock,
+		TeclaLatencyProbe *probe)
+{
+	GList *l, *next;
+	gboolean waiting = FALSE;
+
+	for (l = probe->pending.head; l; l = next) {
+		PendingEvent *event = l->data;
+
+		next = l->next;
+
+		if (event->frame_clock != frame_clock)
+			continue;
+
+		/* The first frame painted after the event shows its effects */
+		if (event->frame_counter < 0) {
+			event->frame_counter =
+				gdk_frame_clock_get_frame_counter (frame_clock);
+			waiting = TRUE;
+		} else if (resolve_event (probe, event)) {
+			g_queue_delete_link (&probe->pending, l);
+			pending_event_free (event);
+		} else {
+			waiting = TRUE;
+		}
+	}
+
+	/* Presentation times arrive with later frames, keep them coming */
+	if (waiting) {
+		gdk_frame_clock_request_phase (frame_clock,
+					       GDK_FRAME_CLOCK_PHASE_AFTER_PAINT);
+	}
+}
+
+static gint64
+get_event_time (GtkEventController *controller)
+{
+	guint32 event_ms;
+	gint64 now_ms;
+
+	/* Event times are 32 bit milliseconds of the monotonic clock,
+	 * extend them using the current time.
+	 */
+	event_ms = gtk_event_controller_get_current_event_time (controller);
+	now_ms = g_get_monotonic_time () / 1000;
+
+	return (now_ms - (guint32) ((guint32) now_ms - event_ms)) * 1000;
+}
+
+static gboolean
+key_pressed_cb (GtkEventControllerKey *controller,
+		guint                  keyval,
+		guint                  keycode,
+		GdkModifierType        state,
+		TeclaLatencyProbe     *probe)
+{
+	/* Only measured once the view shows the press */
+	probe->event_time = get_event_time (GTK_EVENT_CONTROLLER (controller));
+
+	return GDK_EVENT_PROPAGATE;
+}
+
+static void
+key_released_cb (GtkEventControllerKey *controller,
+		 guint                  keyval,
+		 guint                  keycode,
+		 GdkModifierType        state,
+		 TeclaLatencyProbe     *probe)
+{
+	probe->event_time = 0;
+}
+
+static void
+key_press_shown_cb (TeclaView         *view,
+		    TeclaLatencyProbe *probe)
+{
+	GdkFrameClock *frame_clock;
+	PendingEvent *event;
+
+	/* Presses fed without an event are not measured */
+	if (probe->event_time == 0)
+		return;
+
+	frame_clock = gtk_widget_get_frame_clock (GTK_WIDGET (view));
+	if (!frame_clock)
+		return;
+
+	if (!g_ptr_array_find (probe->frame_clocks, frame_clock, NULL)) {
+		g_ptr_array_add (probe->frame_clocks, g_object_ref (frame_clock));
+		g_signal_connect (frame_clock, "after-paint",
+				  G_CALLBACK (after_paint_cb), probe);
+	}
+
+	event = g_new0 (PendingEvent, 1);
+	event->frame_clock = g_object_ref (frame_clock);
+	event->event_time = probe->event_time;
+	event->frame_counter = -1;
+	g_queue_push_tail (&probe->pending, event);
+	probe->event_time = 0;
+
+	/* The state change queued a redraw, the next paint shows it */
+	gdk_frame_clock_request_phase (frame_clock,
+				       GDK_FRAME_CLOCK_PHASE_AFTER_PAINT);
+}
+
+void
+tecla_latency_probe_watch (TeclaLatencyProbe *probe,
+			   TeclaView         *view)
+{
+	GtkEventController *controller;
+
+	g_return_if_fail (TECLA_IS_LATENCY_PROBE (probe));
+	g_return_if_fail (TECLA_IS_VIEW (view));
+
+	/* Capture phase, to see events before the view handles them */
+	controller = gtk_event_controller_key_new ();
+	gtk_event_controller_set_propagation_phase (controller, GTK_PHASE_CAPTURE);
+	g_signal_connect_object (controller, "key-pressed",
+				 G_CALLBACK (key_pressed_cb), probe, 0);
+	g_signal_connect_object (controller, "key-released",
+				 G_CALLBACK (key_released_cb), probe, 0);
+	gtk_widget_add_controller (GTK_WIDGET (view), controller);
+
+	g_signal_connect_object (view, "key-press-shown",
+				 G_CALLBACK (key_press_shown_cb), probe, 0);
+}
+
+static int
+compare_latencies (gconstpointer a,
+		   gconstpointer b)
+{
+	gint64 latency_a = *(const gint64 *) a;
+	gint64 latency_b = *(const gint64 *) b;
+
+	return (latency_a > latency_b) - (latency_a < latency_b);
+}
+
+static double
+get_percentile (GArray *sorted,
+		guint   percentile)
+{
+	guint index;
+
+	index = MIN ((sorted->len * percentile + 99) / 100, sorted->len) - 1;
+
+	return g_array_index (sorted, gint64, index) / 1000.0;
+}
+
+gchar *
+tecla_latency_probe_format_report (TeclaLatencyProbe *probe)
+{
+	g_autoptr (GArray) sorted = NULL;
+	GString *report;
+
+	g_return_val_if_fail (TECLA_IS_LATENCY_PROBE (probe), NULL);
+
+	report = g_string_new (NULL);
+	g_string_append_printf (report,
+				_("Key press to frame latency, %u events, %u discarded\n"),
+				probe->latencies->len,
+				probe->n_discarded + g_queue_get_length (&probe->pending));
+
+	if (probe->latencies->len == 0)
+		return g_string_free (report, FALSE);
+
+	sorted = g_array_copy (probe->latencies);
+	g_array_sort (sorted, compare_latencies);
+
+	g_string_append_printf (report, "p50\t%.2f ms\n", get_percentile (sorted, 50));
+	g_string_append_printf (report, "p90\t%.2f ms\n", get_percentile (sorted, 90));
+	g_string_append_printf (report, "p99\t%.2f ms\n", get_percentile (sorted, 99));
+	g_string_append_printf (report, "max\t%.2f ms\n", get_percentile (sorted, 100));
+
+	return g_string_free (report, FALSE);
+}
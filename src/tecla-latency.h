@@ -0,0 +1,37 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <gtk/gtk.h>
+
+#include "tecla-view.h"
+
+#pragma once
+
+#define TECLA_TYPE_LATENCY_PROBE (tecla_latency_probe_get_type ())
+G_DECLARE_FINAL_TYPE (TeclaLatencyProbe, tecla_latency_probe,
+		      TECLA, LATENCY_PROBE,
+		      GObject)
+
+TeclaLatencyProbe * tecla_latency_probe_new (void);
+
+void tecla_latency_probe_watch (TeclaLatencyProbe *probe,
+				TeclaView         *view);
+
+gchar * tecla_latency_probe_format_report (TeclaLatencyProbe *probe);
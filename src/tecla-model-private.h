@@ -0,0 +1,48 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tecla-model.h"
+
+#pragma once
+
+/* Not part of the libtecla API, lets tecla itself collect statistics
+ * and startup timings of model loading.
+ */
+typedef enum
+{
+	TECLA_MODEL_EVENT_COMPILE_BEGIN,
+	TECLA_MODEL_EVENT_COMPILE_END,
+	TECLA_MODEL_EVENT_SHARED_HIT,
+	TECLA_MODEL_EVENT_CACHE_HIT,
+	TECLA_MODEL_EVENT_CACHE_MISS,
+} TeclaModelEvent;
+
+typedef void (* TeclaModelEventFunc) (TeclaModelEvent event);
+
+void tecla_model_set_event_func (TeclaModelEventFunc func);
+
+/* Compiles the layout from XKB data, bypassing the tables shared with
+ * other models and the model cache.
+ */
+TeclaModel * tecla_model_compile_layout_name (const gchar *name);
+
+/* Key label for the keysyms of a level, as shown in the view */
+gchar * tecla_model_get_keysyms_label (const xkb_keysym_t *keysyms,
+				       int                 n_keysyms);
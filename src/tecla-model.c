@@ -18,14 +18,120 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
  */
 
-#include "tecla-model.h"
+#include "config.h"
 
+#include "tecla-model-private.h"
+
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "pc105.h"
+#include "tecla-compose.h"
+#include "tecla-profiler.h"
+#include "tecla-registry.h"
 #include "tecla-util.h"
 
+#define MODEL_MAGIC "TECLAMDL"
+#define MODEL_VERSION 2
+#define N_LEVELS 8
+#define N_RECENT_MODELS 4
+
+/* Layout names come from the command line and D-Bus */
+#define MAX_LAYOUT_NAME_LENGTH 1024
+#define MAX_GROUPS 4
+#define LAYOUT_NAME_CHARS G_CSET_a_2_z G_CSET_A_2_Z G_CSET_DIGITS "_-."
+
+/* Model tables, these are laid out in a single blob that is either
+ * built from a xkb_keymap, or mapped from the model cache as is.
+ * Offsets are relative to the start of the blob, and all strings
+ * are offsets into the trailing string pool, 0 being the empty
+ * string.
+ */
+typedef struct
+{
+	gchar magic[8];
+	guint32 version;
+	guint32 n_groups;
+	guint32 n_levels;
+	guint32 min_keycode;
+	guint32 n_keycodes;
+	guint32 n_aliases;
+	guint32 name;
+	guint32 groups_offset;
+	guint32 keys_offset;
+	guint32 aliases_offset;
+	guint32 entries_offset;
+	guint32 keysyms_offset;
+	guint32 n_keysyms;
+	guint32 strings_offset;
+	guint32 strings_len;
+	guint32 padding;
+	guint64 stamp;
+} ModelHeader;
+
+typedef struct
+{
+	guint32 name;
+} ModelGroup;
+
+typedef struct
+{
+	guint32 name;
+} ModelKey;
+
+typedef struct
+{
+	guint32 name;
+	guint32 keycode;
+} ModelAlias;
+
+/* Entries are indexed by [group][keycode - min_keycode][level],
+ * the full keysym sequence of a level is found in the keysym array
+ * at [keysyms, keysyms + n_keysyms), keysym is the first of them.
+ */
+typedef struct
+{
+	guint32 keysym;
+	guint32 label;
+	guint32 modifier;
+	guint32 keysyms;
+	guint32 n_keysyms;
+} ModelEntry;
+
+typedef struct
+{
+	GString *strings;
+	GHashTable *offsets;
+} StringPool;
+
+/* The immutable part of a model, shared by all models of a layout.
+ * The current group is kept per TeclaModel, so each window showing
+ * the same layout may show a different group.
+ */
+#define TECLA_TYPE_MODEL_TABLES (tecla_model_tables_get_type ())
+G_DECLARE_FINAL_TYPE (TeclaModelTables, tecla_model_tables,
+		      TECLA, MODEL_TABLES, GObject)
+
+struct _TeclaModelTables
+{
+	GObject parent_instance;
+	GBytes *bytes;
+	const ModelHeader *header;
+	const ModelGroup *groups;
+	const ModelKey *keys;
+	const ModelAlias *aliases;
+	const ModelEntry *entries;
+	const xkb_keysym_t *keysyms;
+	const gchar *strings;
+	GHashTable *keycodes;
+	GHashTable **keysym_index; /* per group, keysym -> packed position */
+};
+
 struct _TeclaModel
 {
 	GObject parent_instance;
-	struct xkb_keymap *xkb_keymap;
+	TeclaModelTables *tables;
 	int group;
 };
 
@@ -46,8 +152,39 @@ enum
 
 static guint signals[N_SIGNALS] = { 0, };
 
+G_DEFINE_TYPE (TeclaModelTables, tecla_model_tables, G_TYPE_OBJECT)
 G_DEFINE_TYPE (TeclaModel, tecla_model, G_TYPE_OBJECT)
 
+/* Models may be compiled from worker threads, each of them
+ * keeps its own xkb_context around for reuse.
+ */
+static GPrivate xkb_context_key = G_PRIVATE_INIT ((GDestroyNotify) xkb_context_unref);
+
+/* Tables of models created from layout names are shared, the registry
+ * holds weak references keyed by normalized name, plus strong references
+ * on the most recently used ones so they survive closing a window.
+ */
+G_LOCK_DEFINE_STATIC (registry);
+static GHashTable *registry = NULL; /* name -> GWeakRef* */
+static GQueue recent_models = G_QUEUE_INIT; /* TeclaModelTables* */
+
+static TeclaModelEventFunc event_func = NULL;
+
+void
+tecla_model_set_event_func (TeclaModelEventFunc func)
+{
+	g_atomic_pointer_set (&event_func, func);
+}
+
+static void
+emit_event (TeclaModelEvent event)
+{
+	TeclaModelEventFunc func = g_atomic_pointer_get (&event_func);
+
+	if (func)
+		func (event);
+}
+
 static void
 tecla_model_get_property (GObject    *object,
 			  guint       prop_id,
@@ -66,12 +203,55 @@ tecla_model_get_property (GObject    *object,
 	}
 }
 
+static void
+tecla_model_tables_finalize (GObject *object)
+{
+	TeclaModelTables *tables = TECLA_MODEL_TABLES (object);
+
+	if (tables->keysym_index) {
+		guint32 group;
+
+		for (group = 0; group < tables->header->n_groups; group++)
+			g_hash_table_unref (tables->keysym_index[group]);
+		g_free (tables->keysym_index);
+	}
+
+	g_clear_pointer (&tables->keycodes, g_hash_table_unref);
+	g_clear_pointer (&tables->bytes, g_bytes_unref);
+
+	G_OBJECT_CLASS (tecla_model_tables_parent_class)->finalize (object);
+}
+
+static void
+tecla_model_tables_class_init (TeclaModelTablesClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = tecla_model_tables_finalize;
+}
+
+static void
+tecla_model_tables_init (TeclaModelTables *tables)
+{
+}
+
+static void
+tecla_model_finalize (GObject *object)
+{
+	TeclaModel *model = TECLA_MODEL (object);
+
+	g_clear_object (&model->tables);
+
+	G_OBJECT_CLASS (tecla_model_parent_class)->finalize (object);
+}
+
 static void
 tecla_model_class_init (TeclaModelClass *klass)
 {
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
 	object_class->get_property = tecla_model_get_property;
+	object_class->finalize = tecla_model_finalize;
 
 	signals[CHANGED] =
 		g_signal_new ("changed",
@@ -145,7 +325,7 @@ static gchar *
 get_key_label (xkb_keysym_t key)
 {
 	const gchar *label = NULL;
-	gchar buf[5];
+	gchar buf[7];
 	gunichar uc;
 
 	switch (key) {
@@ -436,20 +616,24 @@ get_key_label (xkb_keysym_t key)
 	default:
 		uc = gdk_keyval_to_unicode (key);
 
-		if (uc != 0 && g_unichar_isgraph (uc)) {
+		/* Keysyms may encode values past the Unicode range */
+		if (uc != 0 && g_unichar_validate (uc) && g_unichar_isgraph (uc)) {
 			buf[g_unichar_to_utf8 (uc, buf)] = '\0';
 			return g_strdup (buf);
 		} else {
                         const gchar *nick = get_unicode_nick (uc);
-			const gchar *name = gdk_keyval_name (key);
+			gchar name[64];
 
                         if (nick) {
                                 label = nick;
                         }
-			else if (name) {
+			else if (xkb_keysym_get_name (key, name, sizeof (name)) > 0) {
 				g_autofree gchar *fixed_name = NULL;
 				gchar *p;
 
+				/* Unlike gdk_keyval_name(), this is safe to
+				 * use from multiple threads.
+				 */
 				fixed_name = g_strdup (name);
 
 				/* Replace underscores with spaces */
@@ -457,7 +641,7 @@ get_key_label (xkb_keysym_t key)
 					if (*p == '_')
 						*p = ' ';
 				/* Get rid of scary ISO_ prefix */
-				if (g_strstr_len (fixed_name, -1, "ISO "))
+				if (g_str_has_prefix (fixed_name, "ISO "))
 					return g_strdup (fixed_name + 4);
 				else
 					return g_strdup (fixed_name);
@@ -472,112 +656,1032 @@ get_key_label (xkb_keysym_t key)
 	return g_strdup (label);
 }
 
-TeclaModel *
-tecla_model_new_from_xkb_keymap (struct xkb_keymap *xkb_keymap)
+static gchar *
+get_keysyms_label (const xkb_keysym_t *syms,
+		   int                 n_syms)
+{
+	GString *label;
+	int i;
+
+	if (n_syms == 1)
+		return get_key_label (syms[0]);
+
+	/* Levels emitting several keysyms show all of them */
+	label = g_string_new (NULL);
+
+	for (i = 0; i < n_syms; i++) {
+		g_autofree gchar *sym_label = NULL;
+
+		sym_label = get_key_label (syms[i]);
+		g_string_append (label, sym_label);
+	}
+
+	return g_string_free (label, FALSE);
+}
+
+gchar *
+tecla_model_get_keysyms_label (const xkb_keysym_t *keysyms,
+			       int                 n_keysyms)
+{
+	return get_keysyms_label (keysyms, n_keysyms);
+}
+
+static struct xkb_context *
+get_thread_xkb_context (void)
+{
+	struct xkb_context *xkb_context;
+
+	xkb_context = g_private_get (&xkb_context_key);
+
+	if (!xkb_context) {
+		xkb_context = tecla_util_create_xkb_context ();
+		g_private_set (&xkb_context_key, xkb_context);
+	}
+
+	return xkb_context;
+}
+
+static TeclaModelKeyModifier
+get_key_modifier (xkb_keysym_t key)
+{
+	switch (key) {
+	case GDK_KEY_Shift_L:
+	case GDK_KEY_Shift_R:
+		return TECLA_MODEL_KEY_LEVEL2;
+	case GDK_KEY_ISO_Level3_Shift:
+		return TECLA_MODEL_KEY_LEVEL3;
+	case GDK_KEY_ISO_Level5_Shift:
+	case GDK_KEY_ISO_Level5_Latch:
+		return TECLA_MODEL_KEY_LEVEL5;
+	default:
+		return TECLA_MODEL_KEY_NONE;
+	}
+}
+
+static guint32
+string_pool_add (StringPool  *pool,
+		 const gchar *str)
+{
+	gpointer offset;
+
+	if (!str || !*str)
+		return 0;
+
+	if (g_hash_table_lookup_extended (pool->offsets, str, NULL, &offset))
+		return GPOINTER_TO_UINT (offset);
+
+	offset = GUINT_TO_POINTER (pool->strings->len);
+	g_string_append_len (pool->strings, str, strlen (str) + 1);
+	g_hash_table_insert (pool->offsets, g_strdup (str), offset);
+
+	return GPOINTER_TO_UINT (offset);
+}
+
+static GBytes *
+build_tables (struct xkb_keymap *xkb_keymap,
+	      const gchar       *name,
+	      guint64            stamp)
+{
+	ModelHeader header = { 0, };
+	StringPool pool;
+	g_autofree ModelGroup *groups = NULL;
+	g_autofree ModelKey *keys = NULL;
+	g_autoptr (GArray) aliases = NULL;
+	g_autofree ModelEntry *entries = NULL;
+	g_autoptr (GArray) keysyms = NULL;
+	xkb_keycode_t min_keycode, max_keycode, keycode;
+	xkb_layout_index_t group, n_groups;
+	guint32 n_keycodes, n_entries, level;
+	GByteArray *blob;
+	gulong i, j;
+
+	n_groups = xkb_keymap_num_layouts (xkb_keymap);
+	min_keycode = xkb_keymap_min_keycode (xkb_keymap);
+	max_keycode = xkb_keymap_max_keycode (xkb_keymap);
+	n_keycodes = max_keycode - min_keycode + 1;
+	n_entries = n_groups * n_keycodes * N_LEVELS;
+
+	pool.strings = g_string_new_len ("", 1);
+	pool.offsets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	groups = g_new0 (ModelGroup, n_groups);
+	keys = g_new0 (ModelKey, n_keycodes);
+	entries = g_new0 (ModelEntry, n_entries);
+	aliases = g_array_new (FALSE, FALSE, sizeof (ModelAlias));
+	keysyms = g_array_new (FALSE, FALSE, sizeof (xkb_keysym_t));
+
+	for (group = 0; group < n_groups; group++) {
+		groups[group].name =
+			string_pool_add (&pool,
+					 xkb_keymap_layout_get_name (xkb_keymap, group));
+	}
+
+	for (keycode = min_keycode; keycode <= max_keycode; keycode++) {
+		keys[keycode - min_keycode].name =
+			string_pool_add (&pool,
+					 xkb_keymap_key_get_name (xkb_keymap, keycode));
+
+		for (group = 0; group < n_groups; group++) {
+			for (level = 0; level < N_LEVELS; level++) {
+				g_autofree gchar *label = NULL;
+				const xkb_keysym_t *syms;
+				ModelEntry *entry;
+				int n_syms;
+
+				n_syms = xkb_keymap_key_get_syms_by_level (xkb_keymap,
+									   keycode,
+									   group,
+									   level,
+									   &syms);
+				if (n_syms == 0)
+					continue;
+
+				entry = &entries[((group * n_keycodes) +
+						  (keycode - min_keycode)) * N_LEVELS + level];
+				label = get_keysyms_label (syms, n_syms);
+				entry->keysym = syms[0];
+				entry->label = string_pool_add (&pool, label);
+				entry->modifier = get_key_modifier (syms[0]);
+				entry->keysyms = keysyms->len;
+				entry->n_keysyms = n_syms;
+				g_array_append_vals (keysyms, syms, n_syms);
+			}
+		}
+	}
+
+	/* Geometry keys may be referred to by an alias name */
+	for (i = 0; i < G_N_ELEMENTS (pc105_layout.rows); i++) {
+		for (j = 0; j < G_N_ELEMENTS (pc105_layout.rows[i].keys); j++) {
+			const gchar *key_name = pc105_layout.rows[i].keys[j].name;
+			ModelAlias alias;
+
+			if (!key_name)
+				break;
+
+			keycode = xkb_keymap_key_by_name (xkb_keymap, key_name);
+			if (keycode == XKB_KEYCODE_INVALID ||
+			    g_strcmp0 (xkb_keymap_key_get_name (xkb_keymap, keycode),
+				       key_name) == 0)
+				continue;
+
+			alias.name = string_pool_add (&pool, key_name);
+			alias.keycode = keycode;
+			g_array_append_val (aliases, alias);
+		}
+	}
+
+	memcpy (header.magic, MODEL_MAGIC, sizeof (header.magic));
+	header.version = MODEL_VERSION;
+	header.n_groups = n_groups;
+	header.n_levels = N_LEVELS;
+	header.min_keycode = min_keycode;
+	header.n_keycodes = n_keycodes;
+	header.n_aliases = aliases->len;
+	header.name = string_pool_add (&pool, name);
+	header.stamp = stamp;
+	header.groups_offset = sizeof (ModelHeader);
+	header.keys_offset = header.groups_offset + n_groups * sizeof (ModelGroup);
+	header.aliases_offset = header.keys_offset + n_keycodes * sizeof (ModelKey);
+	header.entries_offset = header.aliases_offset + aliases->len * sizeof (ModelAlias);
+	header.keysyms_offset = header.entries_offset + n_entries * sizeof (ModelEntry);
+	header.n_keysyms = keysyms->len;
+	header.strings_offset = header.keysyms_offset + keysyms->len * sizeof (xkb_keysym_t);
+	header.strings_len = pool.strings->len;
+
+	blob = g_byte_array_sized_new (header.strings_offset + header.strings_len);
+	g_byte_array_append (blob, (const guint8 *) &header, sizeof (ModelHeader));
+	g_byte_array_append (blob, (const guint8 *) groups, n_groups * sizeof (ModelGroup));
+	g_byte_array_append (blob, (const guint8 *) keys, n_keycodes * sizeof (ModelKey));
+	g_byte_array_append (blob, (const guint8 *) aliases->data, aliases->len * sizeof (ModelAlias));
+	g_byte_array_append (blob, (const guint8 *) entries, n_entries * sizeof (ModelEntry));
+	g_byte_array_append (blob, (const guint8 *) keysyms->data, keysyms->len * sizeof (xkb_keysym_t));
+	g_byte_array_append (blob, (const guint8 *) pool.strings->str, pool.strings->len);
+
+	g_string_free (pool.strings, TRUE);
+	g_hash_table_unref (pool.offsets);
+
+	return g_byte_array_free_to_bytes (blob);
+}
+
+static gboolean
+validate_tables (GBytes      *bytes,
+		 const gchar *name,
+		 guint64      stamp)
+{
+	const ModelHeader *header;
+	const ModelGroup *groups;
+	const ModelKey *keys;
+	const ModelAlias *aliases;
+	const ModelEntry *entries;
+	const guint8 *data;
+	const gchar *strings;
+	guint64 n_entries, i;
+	gsize size;
+
+	data = g_bytes_get_data (bytes, &size);
+	if (size < sizeof (ModelHeader))
+		return FALSE;
+
+	header = (const ModelHeader *) data;
+	if (memcmp (header->magic, MODEL_MAGIC, sizeof (header->magic)) != 0 ||
+	    header->version != MODEL_VERSION ||
+	    header->n_levels != N_LEVELS ||
+	    header->stamp != stamp ||
+	    header->n_groups == 0 ||
+	    header->n_keycodes == 0)
+		return FALSE;
+
+	n_entries = (guint64) header->n_groups * header->n_keycodes * N_LEVELS;
+
+	if (header->groups_offset != sizeof (ModelHeader) ||
+	    header->keys_offset != header->groups_offset +
+	    (guint64) header->n_groups * sizeof (ModelGroup) ||
+	    header->aliases_offset != header->keys_offset +
+	    (guint64) header->n_keycodes * sizeof (ModelKey) ||
+	    header->entries_offset != header->aliases_offset +
+	    (guint64) header->n_aliases * sizeof (ModelAlias) ||
+	    header->keysyms_offset != header->entries_offset +
+	    n_entries * sizeof (ModelEntry) ||
+	    header->strings_offset != header->keysyms_offset +
+	    (guint64) header->n_keysyms * sizeof (xkb_keysym_t) ||
+	    (guint64) header->strings_offset + header->strings_len != size ||
+	    header->strings_len == 0)
+		return FALSE;
+
+	strings = (const gchar *) data + header->strings_offset;
+	if (strings[header->strings_len - 1] != '\0')
+		return FALSE;
+
+	if (header->name >= header->strings_len ||
+	    g_strcmp0 (strings + header->name, name) != 0)
+		return FALSE;
+
+	groups = (const ModelGroup *) (data + header->groups_offset);
+	for (i = 0; i < header->n_groups; i++) {
+		if (groups[i].name >= header->strings_len)
+			return FALSE;
+	}
+
+	keys = (const ModelKey *) (data + header->keys_offset);
+	for (i = 0; i < header->n_keycodes; i++) {
+		if (keys[i].name >= header->strings_len)
+			return FALSE;
+	}
+
+	aliases = (const ModelAlias *) (data + header->aliases_offset);
+	for (i = 0; i < header->n_aliases; i++) {
+		if (aliases[i].name >= header->strings_len)
+			return FALSE;
+	}
+
+	entries = (const ModelEntry *) (data + header->entries_offset);
+	for (i = 0; i < n_entries; i++) {
+		if (entries[i].label >= header->strings_len ||
+		    (guint64) entries[i].keysyms + entries[i].n_keysyms > header->n_keysyms)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gchar *
+get_cache_path (const gchar *name)
+{
+	g_autofree gchar *filename = NULL;
+
+	filename = g_strconcat (name, ".model", NULL);
+	g_strcanon (filename,
+		    G_CSET_a_2_z G_CSET_A_2_Z G_CSET_DIGITS "+,-_.",
+		    '_');
+
+	return g_build_filename (g_get_user_cache_dir (),
+				 "tecla", "models", filename, NULL);
+}
+
+static GBytes *
+load_tables (const gchar *path,
+	     const gchar *name,
+	     guint64      stamp)
+{
+	g_autoptr (GMappedFile) mapped_file = NULL;
+	g_autoptr (GBytes) bytes = NULL;
+
+	mapped_file = g_mapped_file_new (path, FALSE, NULL);
+	if (!mapped_file)
+		return NULL;
+
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	if (!validate_tables (bytes, name, stamp))
+		return NULL;
+
+	return g_steal_pointer (&bytes);
+}
+
+static void
+save_tables (const gchar *path,
+	     GBytes      *bytes)
+{
+	g_autofree gchar *dir = NULL;
+	g_autoptr (GError) error = NULL;
+	gconstpointer data;
+	gsize size;
+
+	dir = g_path_get_dirname (path);
+	if (g_mkdir_with_parents (dir, 0700) < 0) {
+		g_debug ("Could not create %s: %s", dir, g_strerror (errno));
+		return;
+	}
+
+	/* Written atomically, so concurrent readers never see partial files */
+	data = g_bytes_get_data (bytes, &size);
+	if (!g_file_set_contents (path, data, size, &error))
+		g_debug ("Could not save model cache: %s", error->message);
+}
+
+static void
+weak_ref_free (GWeakRef *ref)
+{
+	g_weak_ref_clear (ref);
+	g_free (ref);
+}
+
+static gboolean
+weak_ref_is_empty (gpointer  key,
+		   GWeakRef *ref,
+		   gpointer  user_data)
+{
+	g_autoptr (GObject) object = NULL;
+
+	object = g_weak_ref_get (ref);
+
+	return object == NULL;
+}
+
+/* Called with the registry lock held */
+static void
+touch_recent_tables (TeclaModelTables *tables)
+{
+	if (g_queue_remove (&recent_models, tables))
+		g_object_unref (tables);
+
+	g_queue_push_head (&recent_models, g_object_ref (tables));
+
+	while (g_queue_get_length (&recent_models) > N_RECENT_MODELS)
+		g_object_unref (g_queue_pop_tail (&recent_models));
+}
+
+static TeclaModelTables *
+lookup_tables (const gchar *name)
+{
+	TeclaModelTables *tables = NULL;
+	GWeakRef *ref;
+
+	G_LOCK (registry);
+
+	if (registry && (ref = g_hash_table_lookup (registry, name)))
+		tables = g_weak_ref_get (ref);
+
+	if (tables)
+		touch_recent_tables (tables);
+
+	G_UNLOCK (registry);
+
+	return tables;
+}
+
+static TeclaModelTables *
+register_tables (const gchar      *name,
+		 TeclaModelTables *tables)
+{
+	TeclaModelTables *registered = NULL;
+	GWeakRef *ref;
+
+	G_LOCK (registry);
+
+	if (!registry) {
+		registry = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+						  (GDestroyNotify) weak_ref_free);
+	}
+
+	g_hash_table_foreach_remove (registry, (GHRFunc) weak_ref_is_empty, NULL);
+
+	/* Another thread may have registered the same layout meanwhile */
+	ref = g_hash_table_lookup (registry, name);
+	if (ref)
+		registered = g_weak_ref_get (ref);
+
+	if (!registered) {
+		ref = g_new0 (GWeakRef, 1);
+		g_weak_ref_init (ref, tables);
+		g_hash_table_insert (registry, g_strdup (name), ref);
+		registered = g_object_ref (tables);
+	}
+
+	touch_recent_tables (registered);
+
+	G_UNLOCK (registry);
+
+	return registered;
+}
+
+static TeclaModelTables *
+tecla_model_tables_new (GBytes *bytes)
+{
+	TeclaModelTables *tables;
+	const guint8 *data;
+	guint32 i;
+
+	tables = g_object_new (TECLA_TYPE_MODEL_TABLES, NULL);
+	tables->bytes = g_bytes_ref (bytes);
+
+	data = g_bytes_get_data (bytes, NULL);
+	tables->header = (const ModelHeader *) data;
+	tables->groups = (const ModelGroup *) (data + tables->header->groups_offset);
+	tables->keys = (const ModelKey *) (data + tables->header->keys_offset);
+	tables->aliases = (const ModelAlias *) (data + tables->header->aliases_offset);
+	tables->entries = (const ModelEntry *) (data + tables->header->entries_offset);
+	tables->keysyms = (const xkb_keysym_t *) (data + tables->header->keysyms_offset);
+	tables->strings = (const gchar *) (data + tables->header->strings_offset);
+
+	tables->keycodes = g_hash_table_new (g_str_hash, g_str_equal);
+
+	for (i = 0; i < tables->header->n_keycodes; i++) {
+		if (tables->keys[i].name == 0)
+			continue;
+
+		g_hash_table_insert (tables->keycodes,
+				     (gpointer) (tables->strings + tables->keys[i].name),
+				     GUINT_TO_POINTER (tables->header->min_keycode + i));
+	}
+
+	for (i = 0; i < tables->header->n_aliases; i++) {
+		g_hash_table_insert (tables->keycodes,
+				     (gpointer) (tables->strings + tables->aliases[i].name),
+				     GUINT_TO_POINTER (tables->aliases[i].keycode));
+	}
+
+	return tables;
+}
+
+static TeclaModel *
+tecla_model_new_for_tables (TeclaModelTables *tables)
 {
 	TeclaModel *model;
 
 	model = g_object_new (TECLA_TYPE_MODEL, NULL);
-	model->xkb_keymap = xkb_keymap_ref (xkb_keymap);
+	model->tables = g_object_ref (tables);
 
 	return model;
 }
 
+static TeclaModelTables * load_layout_tables (const gchar *name);
+
+/* Keymaps sent by the compositor do not carry the layout names they
+ * were compiled from, but their group names are the descriptions
+ * found in the registry.
+ */
+static gchar *
+guess_layout_name (struct xkb_keymap *xkb_keymap)
+{
+	TeclaRegistry *layouts;
+	g_autoptr (GString) name = NULL;
+	xkb_layout_index_t group;
+	guint i;
+
+	layouts = tecla_registry_get_default ();
+	name = g_string_new (NULL);
+
+	for (group = 0; group < xkb_keymap_num_layouts (xkb_keymap); group++) {
+		const gchar *description;
+		const TeclaRegistryLayout *layout = NULL;
+
+		description = xkb_keymap_layout_get_name (xkb_keymap, group);
+		if (!description)
+			return NULL;
+
+		for (i = 0; i < tecla_registry_get_n_layouts (layouts); i++) {
+			layout = tecla_registry_get_layout (layouts, i);
+			if (g_strcmp0 (layout->description, description) == 0)
+				break;
+			layout = NULL;
+		}
+
+		if (!layout)
+			return NULL;
+
+		g_string_append_printf (name, "%s%s", group > 0 ? "," : "",
+					layout->name);
+	}
+
+	return g_string_free (g_steal_pointer (&name), FALSE);
+}
+
+static gboolean
+tables_have_same_labels (TeclaModelTables *a,
+			 TeclaModelTables *b)
+{
+	guint64 n_entries, i;
+	guint32 group;
+
+	if (a->header->n_groups != b->header->n_groups ||
+	    a->header->min_keycode != b->header->min_keycode ||
+	    a->header->n_keycodes != b->header->n_keycodes)
+		return FALSE;
+
+	for (group = 0; group < a->header->n_groups; group++) {
+		if (strcmp (a->strings + a->groups[group].name,
+			    b->strings + b->groups[group].name) != 0)
+			return FALSE;
+	}
+
+	n_entries = (guint64) a->header->n_groups * a->header->n_keycodes * N_LEVELS;
+
+	for (i = 0; i < n_entries; i++) {
+		const ModelEntry *entry_a = &a->entries[i];
+		const ModelEntry *entry_b = &b->entries[i];
+
+		if (entry_a->keysym != entry_b->keysym ||
+		    entry_a->n_keysyms != entry_b->n_keysyms ||
+		    memcmp (&a->keysyms[entry_a->keysyms],
+			    &b->keysyms[entry_b->keysyms],
+			    entry_a->n_keysyms * sizeof (xkb_keysym_t)) != 0 ||
+		    strcmp (a->strings + entry_a->label,
+			    b->strings + entry_b->label) != 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * tecla_model_new_from_xkb_keymap: (skip)
+ */
 TeclaModel *
-tecla_model_new_from_layout_name (const gchar *name)
+tecla_model_new_from_xkb_keymap (struct xkb_keymap *xkb_keymap)
+{
+	g_autoptr (GBytes) bytes = NULL;
+	g_autoptr (TeclaModelTables) tables = NULL;
+	g_autofree gchar *name = NULL;
+	TeclaModel *model;
+
+	g_return_val_if_fail (xkb_keymap != NULL, NULL);
+
+	TECLA_PROFILER_BEGIN_MARK;
+	emit_event (TECLA_MODEL_EVENT_COMPILE_BEGIN);
+
+	bytes = build_tables (xkb_keymap, NULL, 0);
+	tables = tecla_model_tables_new (bytes);
+
+	emit_event (TECLA_MODEL_EVENT_COMPILE_END);
+
+	/* Share the tables of the layout previewed elsewhere, but only if
+	 * no options or user configuration made the keymap different.
+	 */
+	name = guess_layout_name (xkb_keymap);
+	if (name) {
+		g_autoptr (TeclaModelTables) shared = NULL;
+
+		shared = load_layout_tables (name);
+		if (shared && tables_have_same_labels (shared, tables))
+			g_set_object (&tables, shared);
+	}
+
+	model = tecla_model_new_for_tables (tables);
+
+	TECLA_PROFILER_END_MARK ("Model from keymap", "%u bytes",
+				 (guint) g_bytes_get_size (bytes));
+
+	return model;
+}
+
+/* Layout names are "layout[+variant]" per group, comma separated,
+ * optionally followed by XKB options in brackets, for example
+ * "us,ru+phonetic[grp:alt_shift_toggle]". Returns the normalized
+ * name, and the RMLVO strings to compile it from.
+ */
+static gchar *
+parse_layout_name (const gchar  *name,
+		   gchar       **layouts,
+		   gchar       **variants,
+		   gchar       **options)
+{
+	g_autoptr (GString) normalized = NULL;
+	g_autoptr (GString) layouts_str = NULL;
+	g_autoptr (GString) variants_str = NULL;
+	g_autofree gchar *options_str = NULL;
+	g_autofree gchar *groups_str = NULL;
+	g_auto (GStrv) groups = NULL;
+	gboolean has_variants = FALSE;
+	const gchar *bracket;
+	guint i;
+
+	if (!memchr (name, '\0', MAX_LAYOUT_NAME_LENGTH + 1))
+		return NULL;
+
+	bracket = strchr (name, '[');
+	if (bracket) {
+		const gchar *end = strchr (bracket, ']');
+
+		if (!end || end[1] != '\0')
+			return NULL;
+
+		options_str = g_strstrip (g_strndup (bracket + 1, end - bracket - 1));
+		groups_str = g_strndup (name, bracket - name);
+	} else {
+		groups_str = g_strdup (name);
+	}
+
+	normalized = g_string_new (NULL);
+	layouts_str = g_string_new (NULL);
+	variants_str = g_string_new (NULL);
+	groups = g_strsplit (groups_str, ",", -1);
+	if (g_strv_length (groups) > MAX_GROUPS)
+		return NULL;
+
+	for (i = 0; groups[i]; i++) {
+		gchar *group = g_strstrip (groups[i]);
+		const gchar *variant = "";
+		gchar *sep;
+
+		sep = strpbrk (group, "+ \t");
+		if (sep) {
+			*sep = '\0';
+			variant = g_strstrip (sep + 1);
+		}
+
+		if (!*group ||
+		    strspn (group, LAYOUT_NAME_CHARS) != strlen (group) ||
+		    strspn (variant, LAYOUT_NAME_CHARS) != strlen (variant))
+			return NULL;
+
+		if (i > 0) {
+			g_string_append_c (normalized, ',');
+			g_string_append_c (layouts_str, ',');
+			g_string_append_c (variants_str, ',');
+		}
+
+		g_string_append (normalized, group);
+		g_string_append (layouts_str, group);
+		g_string_append (variants_str, variant);
+
+		if (*variant) {
+			g_string_append_printf (normalized, "+%s", variant);
+			has_variants = TRUE;
+		}
+	}
+
+	if (i == 0)
+		return NULL;
+
+	if (options_str &&
+	    strspn (options_str, LAYOUT_NAME_CHARS ":,") != strlen (options_str))
+		return NULL;
+
+	if (options_str && *options_str)
+		g_string_append_printf (normalized, "[%s]", options_str);
+	else
+		g_clear_pointer (&options_str, g_free);
+
+	*layouts = g_string_free (g_steal_pointer (&layouts_str), FALSE);
+	*variants = has_variants ?
+		g_string_free (g_steal_pointer (&variants_str), FALSE) : NULL;
+	*options = g_steal_pointer (&options_str);
+
+	return g_string_free (g_steal_pointer (&normalized), FALSE);
+}
+
+gchar *
+tecla_model_build_layout_name (const gchar *layouts,
+			       const gchar *variants,
+			       const gchar *options)
+{
+	g_auto (GStrv) split_layouts = NULL;
+	g_auto (GStrv) split_variants = NULL;
+	GString *name;
+	guint i, n_variants = 0;
+
+	g_return_val_if_fail (layouts != NULL, NULL);
+
+	split_layouts = g_strsplit (layouts, ",", -1);
+	if (variants) {
+		split_variants = g_strsplit (variants, ",", -1);
+		n_variants = g_strv_length (split_variants);
+	}
+
+	name = g_string_new (NULL);
+
+	for (i = 0; split_layouts[i]; i++) {
+		if (i > 0)
+			g_string_append_c (name, ',');
+
+		g_string_append (name, split_layouts[i]);
+
+		if (i < n_variants && *split_variants[i])
+			g_string_append_printf (name, "+%s", split_variants[i]);
+	}
+
+	if (options && *options)
+		g_string_append_printf (name, "[%s]", options);
+
+	return g_string_free (name, FALSE);
+}
+
+guint64
+tecla_model_get_layout_stamp (const gchar *name)
+{
+	/* Layouts may include any XKB file, so all share the same stamp */
+	return tecla_util_get_xkb_stamp (get_thread_xkb_context ());
+}
+
+static GBytes *
+compile_tables (struct xkb_context *xkb_context,
+		const gchar        *normalized,
+		const gchar        *layouts,
+		const gchar        *variants,
+		const gchar        *options,
+		guint64             stamp)
 {
-	TeclaModel *model = NULL;
-	struct xkb_context *xkb_context;
 	struct xkb_keymap *xkb_keymap;
-	g_autofree gchar *layout = NULL;
-	const gchar *variant = NULL, *sep;
+	GBytes *bytes;
 	struct xkb_rule_names rule_names = {
 		.rules = "evdev",
 		.model = "pc105",
 	};
 
-	sep = strchr (name, '+');
-	if (!sep)
-		sep = strchr (name, ' ');
-	if (!sep)
-		sep = strchr (name, '\t');
+	rule_names.layout = layouts;
+	rule_names.variant = variants;
+	rule_names.options = options;
 
-	if (sep) {
-		variant = sep + 1;
-		layout = g_strndup (name, sep - name);
-	} else {
-		layout = g_strdup (name);
+	xkb_keymap = xkb_keymap_new_from_names (xkb_context, &rule_names, 0);
+	if (!xkb_keymap)
+		return NULL;
+
+	bytes = build_tables (xkb_keymap, normalized, stamp);
+	xkb_keymap_unref (xkb_keymap);
+
+	return bytes;
+}
+
+static TeclaModelTables *
+load_layout_tables (const gchar *name)
+{
+	struct xkb_context *xkb_context;
+	g_autoptr (TeclaModelTables) tables = NULL;
+	g_autoptr (GBytes) bytes = NULL;
+	g_autofree gchar *layouts = NULL;
+	g_autofree gchar *variants = NULL;
+	g_autofree gchar *options = NULL;
+	g_autofree gchar *normalized = NULL;
+	g_autofree gchar *cache_path = NULL;
+	guint64 stamp;
+
+	normalized = parse_layout_name (name, &layouts, &variants, &options);
+	if (!normalized)
+		return NULL;
+
+	tables = lookup_tables (normalized);
+	if (tables) {
+		emit_event (TECLA_MODEL_EVENT_SHARED_HIT);
+		return g_steal_pointer (&tables);
 	}
 
-	rule_names.layout = layout;
-	rule_names.variant = variant;
+	xkb_context = get_thread_xkb_context ();
+	stamp = tecla_util_get_xkb_stamp (xkb_context);
+	cache_path = get_cache_path (normalized);
 
-	xkb_context = tecla_util_create_xkb_context ();
-	xkb_keymap = xkb_keymap_new_from_names (xkb_context, &rule_names, 0);
-	xkb_context_unref (xkb_context);
+	bytes = load_tables (cache_path, normalized, stamp);
+
+	if (bytes) {
+		emit_event (TECLA_MODEL_EVENT_CACHE_HIT);
+	} else {
+		emit_event (TECLA_MODEL_EVENT_CACHE_MISS);
 
-	if (xkb_keymap) {
-		model = tecla_model_new_from_xkb_keymap (xkb_keymap);
-		xkb_keymap_unref (xkb_keymap);
+		bytes = compile_tables (xkb_context, normalized,
+					layouts, variants, options, stamp);
+		if (!bytes)
+			return NULL;
+
+		save_tables (cache_path, bytes);
 	}
 
+	tables = tecla_model_tables_new (bytes);
+
+	return register_tables (normalized, tables);
+}
+
+TeclaModel *
+tecla_model_compile_layout_name (const gchar *name)
+{
+	g_autoptr (TeclaModelTables) tables = NULL;
+	g_autoptr (GBytes) bytes = NULL;
+	g_autofree gchar *layouts = NULL;
+	g_autofree gchar *variants = NULL;
+	g_autofree gchar *options = NULL;
+	g_autofree gchar *normalized = NULL;
+
+	normalized = parse_layout_name (name, &layouts, &variants, &options);
+	if (!normalized)
+		return NULL;
+
+	/* Neither shared nor cached, the stamp is never checked */
+	bytes = compile_tables (get_thread_xkb_context (), normalized,
+				layouts, variants, options, 0);
+	if (!bytes)
+		return NULL;
+
+	tables = tecla_model_tables_new (bytes);
+
+	return tecla_model_new_for_tables (tables);
+}
+
+/**
+ * tecla_model_new_from_layout_name:
+ * @name: a layout name, such as "us" or "us,ru+phonetic"
+ *
+ * Returns: (transfer full) (nullable): a new model, its tables are
+ *   shared with other models of the same layout
+ */
+TeclaModel *
+tecla_model_new_from_layout_name (const gchar *name)
+{
+	g_autoptr (TeclaModelTables) tables = NULL;
+	TeclaModel *model = NULL;
+
+	TECLA_PROFILER_BEGIN_MARK;
+	emit_event (TECLA_MODEL_EVENT_COMPILE_BEGIN);
+
+	tables = load_layout_tables (name);
+	if (tables)
+		model = tecla_model_new_for_tables (tables);
+
+	emit_event (TECLA_MODEL_EVENT_COMPILE_END);
+
+	TECLA_PROFILER_END_MARK ("Model from layout", "%s", name);
+
 	return model;
 }
 
+static const ModelEntry *
+get_entry (TeclaModel    *model,
+	   int            group,
+	   int            level,
+	   xkb_keycode_t  keycode)
+{
+	const ModelHeader *header = model->tables->header;
+
+	if (keycode < header->min_keycode ||
+	    keycode - header->min_keycode >= header->n_keycodes ||
+	    level < 0 || level >= N_LEVELS)
+		return NULL;
+
+	group = (guint32) group % header->n_groups;
+
+	return &model->tables->entries[(((guint32) group * header->n_keycodes) +
+				(keycode - header->min_keycode)) * N_LEVELS + level];
+}
+
+/**
+ * tecla_model_get_keycode_key:
+ * @keycode: (type guint32): a keycode
+ *
+ * Returns: (nullable): the XKB key name, or %NULL if the keycode is unused
+ */
 const gchar *
 tecla_model_get_keycode_key (TeclaModel    *model,
 			     xkb_keycode_t  keycode)
 {
-	return xkb_keymap_key_get_name (model->xkb_keymap, keycode);
+	const ModelHeader *header = model->tables->header;
+	guint32 name;
+
+	if (keycode < header->min_keycode ||
+	    keycode - header->min_keycode >= header->n_keycodes)
+		return NULL;
+
+	name = model->tables->keys[keycode - header->min_keycode].name;
+
+	return name != 0 ? model->tables->strings + name : NULL;
 }
 
+/**
+ * tecla_model_get_key_keycode:
+ * @key: (nullable): an XKB key name, or an alias of it
+ *
+ * Returns: (type guint32): the keycode, or %XKB_KEYCODE_INVALID
+ */
 xkb_keycode_t
 tecla_model_get_key_keycode (TeclaModel  *model,
 			     const gchar *key)
 {
-	return xkb_keymap_key_by_name (model->xkb_keymap, key);
+	gpointer keycode;
+
+	if (!key ||
+	    !g_hash_table_lookup_extended (model->tables->keycodes, key, NULL, &keycode))
+		return XKB_KEYCODE_INVALID;
+
+	return GPOINTER_TO_UINT (keycode);
 }
 
-gchar *
+const gchar *
 tecla_model_get_key_label (TeclaModel  *model,
 			   int          level,
 			   const gchar *key)
 {
-	xkb_keycode_t keycode;
-	guint keysym;
+	const ModelEntry *entry;
 
-	keycode = xkb_keymap_key_by_name (model->xkb_keymap, key);
-	keysym = tecla_model_get_keyval (model, level, keycode);
+	entry = get_entry (model, model->group, level,
+			   tecla_model_get_key_keycode (model, key));
 
-	if (keysym == 0)
+	if (!entry || entry->keysym == 0)
 		return NULL;
 
-	return get_key_label (keysym);
+	return model->tables->strings + entry->label;
 }
 
+/**
+ * tecla_model_get_keyval:
+ * @keycode: (type guint32): a keycode
+ *
+ * Returns: the first keysym at the level of the current group, or 0
+ */
 guint
 tecla_model_get_keyval (TeclaModel    *model,
 			int            level,
 			xkb_keycode_t  keycode)
 {
-	const xkb_keysym_t *syms;
-	int n_syms;
+	const ModelEntry *entry;
 
-	n_syms = xkb_keymap_key_get_syms_by_level (model->xkb_keymap,
-						   keycode,
-						   model->group,
-						   level,
-						   &syms);
-	if (n_syms == 0)
-		return 0;
+	entry = get_entry (model, model->group, level, keycode);
 
-	return syms[0];
+	return entry ? entry->keysym : 0;
+}
+
+/**
+ * tecla_model_get_keysyms: (skip)
+ */
+const xkb_keysym_t *
+tecla_model_get_keysyms (TeclaModel    *model,
+			 int            level,
+			 xkb_keycode_t  keycode,
+			 int           *n_keysyms)
+{
+	const ModelEntry *entry;
+
+	entry = get_entry (model, model->group, level, keycode);
+
+	if (!entry || entry->n_keysyms == 0) {
+		*n_keysyms = 0;
+		return NULL;
+	}
+
+	*n_keysyms = entry->n_keysyms;
+
+	return &model->tables->keysyms[entry->keysyms];
+}
+
+/**
+ * tecla_model_get_key_modifier:
+ * @keycode: (type guint32): a keycode
+ */
+TeclaModelKeyModifier
+tecla_model_get_key_modifier (TeclaModel    *model,
+			      xkb_keycode_t  keycode)
+{
+	const ModelEntry *entry;
+
+	entry = get_entry (model, model->group, 0, keycode);
+
+	return entry ? entry->modifier : TECLA_MODEL_KEY_NONE;
 }
 
 const gchar *
 tecla_model_get_name (TeclaModel *model)
 {
-	return xkb_keymap_layout_get_name (model->xkb_keymap, model->group);
+	guint32 group;
+
+	group = (guint32) model->group % model->tables->header->n_groups;
+
+	return model->tables->strings + model->tables->groups[group].name;
+}
+
+guint
+tecla_model_get_n_groups (TeclaModel *model)
+{
+	return model->tables->header->n_groups;
+}
+
+const gchar *
+tecla_model_get_group_name (TeclaModel *model,
+			    guint       group)
+{
+	g_return_val_if_fail (group < model->tables->header->n_groups, NULL);
+
+	return model->tables->strings + model->tables->groups[group].name;
+}
+
+int
+tecla_model_get_group (TeclaModel *model)
+{
+	return (guint32) model->group % model->tables->header->n_groups;
 }
 
 void
@@ -588,3 +1692,446 @@ tecla_model_set_group (TeclaModel *model,
 	g_object_notify (G_OBJECT (model), "name");
 	g_signal_emit (model, signals[CHANGED], 0);
 }
+
+static void
+index_keysym (xkb_keycode_t   keycode,
+	      int             group,
+	      int             level,
+	      xkb_keysym_t    keysym,
+	      GHashTable    **index)
+{
+	/* Lower levels come first, they take fewer modifiers to reach */
+	if (g_hash_table_contains (index[group], GUINT_TO_POINTER (keysym)))
+		return;
+
+	g_hash_table_insert (index[group], GUINT_TO_POINTER (keysym),
+			     GUINT_TO_POINTER ((keycode << 8) | (level + 1)));
+}
+
+static GHashTable **
+build_keysym_index (TeclaModel *model)
+{
+	GHashTable **index;
+	guint32 group;
+
+	index = g_new0 (GHashTable *, model->tables->header->n_groups);
+
+	for (group = 0; group < model->tables->header->n_groups; group++)
+		index[group] = g_hash_table_new (NULL, NULL);
+
+	tecla_model_foreach_keysym (model, (TeclaModelKeysymFunc) index_keysym,
+				    index);
+
+	return index;
+}
+
+static gboolean
+find_keysym_in_group (TeclaModel            *model,
+		      xkb_keysym_t           keysym,
+		      guint32                group,
+		      TeclaModelKeyPosition *position)
+{
+	guint packed;
+
+	if (g_once_init_enter (&model->tables->keysym_index))
+		g_once_init_leave (&model->tables->keysym_index, build_keysym_index (model));
+
+	packed = GPOINTER_TO_UINT (g_hash_table_lookup (model->tables->keysym_index[group],
+							GUINT_TO_POINTER (keysym)));
+	if (packed == 0)
+		return FALSE;
+
+	position->keycode = packed >> 8;
+	position->group = group;
+	position->level = (packed & 0xff) - 1;
+	position->dead_keycode = 0;
+	position->dead_level = 0;
+
+	return TRUE;
+}
+
+/**
+ * tecla_model_find_keysym:
+ * @keysym: (type guint32): a keysym
+ * @position: (out caller-allocates):
+ */
+gboolean
+tecla_model_find_keysym (TeclaModel            *model,
+			 xkb_keysym_t           keysym,
+			 TeclaModelKeyPosition *position)
+{
+	guint32 current, i;
+
+	g_return_val_if_fail (TECLA_IS_MODEL (model), FALSE);
+	g_return_val_if_fail (position != NULL, FALSE);
+
+	/* Prefer the current group, then the others in order */
+	current = (guint32) model->group % model->tables->header->n_groups;
+
+	if (find_keysym_in_group (model, keysym, current, position))
+		return TRUE;
+
+	for (i = 0; i < model->tables->header->n_groups; i++) {
+		if (i != current &&
+		    find_keysym_in_group (model, keysym, i, position))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean
+find_char_directly (TeclaModel            *model,
+		    gunichar               ch,
+		    TeclaModelKeyPosition *position)
+{
+	xkb_keysym_t keysym;
+
+	/* Keymaps may use either the legacy or the Unicode keysym */
+	keysym = xkb_utf32_to_keysym (ch);
+	if (keysym != XKB_KEY_NoSymbol &&
+	    tecla_model_find_keysym (model, keysym, position))
+		return TRUE;
+
+	return tecla_model_find_keysym (model, 0x01000000 | ch, position);
+}
+
+static xkb_keysym_t
+get_dead_keysym (gunichar mark)
+{
+	static const struct {
+		gunichar mark;
+		xkb_keysym_t keysym;
+	} dead_keys[] = {
+		{ 0x0300, GDK_KEY_dead_grave },
+		{ 0x0301, GDK_KEY_dead_acute },
+		{ 0x0302, GDK_KEY_dead_circumflex },
+		{ 0x0303, GDK_KEY_dead_tilde },
+		{ 0x0304, GDK_KEY_dead_macron },
+		{ 0x0306, GDK_KEY_dead_breve },
+		{ 0x0307, GDK_KEY_dead_abovedot },
+		{ 0x0308, GDK_KEY_dead_diaeresis },
+		{ 0x0309, GDK_KEY_dead_hook },
+		{ 0x030A, GDK_KEY_dead_abovering },
+		{ 0x030B, GDK_KEY_dead_doubleacute },
+		{ 0x030C, GDK_KEY_dead_caron },
+		{ 0x0313, GDK_KEY_dead_abovecomma },
+		{ 0x0314, GDK_KEY_dead_abovereversedcomma },
+		{ 0x031B, GDK_KEY_dead_horn },
+		{ 0x0323, GDK_KEY_dead_belowdot },
+		{ 0x0324, GDK_KEY_dead_belowdiaeresis },
+		{ 0x0325, GDK_KEY_dead_belowring },
+		{ 0x0326, GDK_KEY_dead_belowcomma },
+		{ 0x0327, GDK_KEY_dead_cedilla },
+		{ 0x0328, GDK_KEY_dead_ogonek },
+		{ 0x032D, GDK_KEY_dead_belowcircumflex },
+		{ 0x032E, GDK_KEY_dead_belowbreve },
+		{ 0x0330, GDK_KEY_dead_belowtilde },
+		{ 0x0331, GDK_KEY_dead_belowmacron },
+		{ 0x0345, GDK_KEY_dead_iota },
+	};
+	gsize i;
+
+	for (i = 0; i < G_N_ELEMENTS (dead_keys); i++) {
+		if (dead_keys[i].mark == mark)
+			return dead_keys[i].keysym;
+	}
+
+	return XKB_KEY_NoSymbol;
+}
+
+static gboolean
+find_char_composed (TeclaModel            *model,
+		    gunichar               ch,
+		    TeclaModelKeyPosition *position)
+{
+	const TeclaComposeSequence *sequences;
+	gchar utf8[7] = { 0, };
+	guint n_sequences, i;
+
+	/* Dead key sequences from the compose table of the current locale */
+	g_unichar_to_utf8 (ch, utf8);
+	sequences = tecla_compose_find_sequences (tecla_compose_get_default (),
+						  utf8, &n_sequences);
+
+	for (i = 0; i < n_sequences; i++) {
+		TeclaModelKeyPosition dead_position;
+
+		if (!tecla_model_find_keysym (model, sequences[i].dead_keysym,
+					      &dead_position) ||
+		    !find_keysym_in_group (model, sequences[i].keysym,
+					   dead_position.group, position))
+			continue;
+
+		position->dead_keycode = dead_position.keycode;
+		position->dead_level = dead_position.level;
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * tecla_model_find_char:
+ * @position: (out caller-allocates):
+ */
+gboolean
+tecla_model_find_char (TeclaModel            *model,
+		       gunichar               ch,
+		       TeclaModelKeyPosition *position)
+{
+	TeclaModelKeyPosition dead_position;
+	gunichar base, mark;
+	xkb_keysym_t dead_keysym;
+
+	g_return_val_if_fail (TECLA_IS_MODEL (model), FALSE);
+	g_return_val_if_fail (position != NULL, FALSE);
+
+	if (find_char_directly (model, ch, position))
+		return TRUE;
+
+	/* Otherwise, look for a dead key followed by the base character */
+	if (!g_unichar_decompose (ch, &base, &mark) || mark == 0)
+		return find_char_composed (model, ch, position);
+
+	dead_keysym = get_dead_keysym (mark);
+	if (dead_keysym == XKB_KEY_NoSymbol ||
+	    !find_char_directly (model, base, position) ||
+	    !find_keysym_in_group (model, dead_keysym, position->group,
+				   &dead_position))
+		return find_char_composed (model, ch, position);
+
+	position->dead_keycode = dead_position.keycode;
+	position->dead_level = dead_position.level;
+
+	return TRUE;
+}
+
+/**
+ * tecla_model_foreach_keysym:
+ * @func: (scope call) (closure user_data):
+ * @user_data: data passed to @func
+ */
+void
+tecla_model_foreach_keysym (TeclaModel           *model,
+			    TeclaModelKeysymFunc  func,
+			    gpointer              user_data)
+{
+	const ModelHeader *header = model->tables->header;
+	guint32 group, i;
+	int level;
+
+	/* Same order as the keysym index, lowest levels first. Levels
+	 * emitting several keysyms do not type any single one of them,
+	 * so they are skipped.
+	 */
+	for (group = 0; group < header->n_groups; group++) {
+		for (level = 0; level < N_LEVELS; level++) {
+			for (i = 0; i < header->n_keycodes; i++) {
+				xkb_keycode_t keycode = header->min_keycode + i;
+				const ModelEntry *entry;
+
+				entry = get_entry (model, group, level, keycode);
+				if (entry && entry->n_keysyms == 1 &&
+				    entry->keysym != XKB_KEY_NoSymbol)
+					func (keycode, group, level, entry->keysym, user_data);
+			}
+		}
+	}
+}
+
+static void
+append_json_string (GString     *str,
+		    const gchar *value)
+{
+	const gchar *p;
+
+	g_string_append_c (str, '"');
+
+	for (p = value; p && *p; p++) {
+		if (*p == '"' || *p == '\\')
+			g_string_append_printf (str, "\\%c", *p);
+		else if ((guchar) *p < 0x20)
+			g_string_append_printf (str, "\\u%04x", (guchar) *p);
+		else
+			g_string_append_c (str, *p);
+	}
+
+	g_string_append_c (str, '"');
+}
+
+static gboolean
+flush_row (GOutputStream  *stream,
+	   GString        *row,
+	   GError        **error)
+{
+	if (!g_output_stream_write_all (stream, row->str, row->len,
+					NULL, NULL, error))
+		return FALSE;
+
+	g_string_truncate (row, 0);
+
+	return TRUE;
+}
+
+static void
+serialize_level (TeclaModel       *model,
+		 TeclaModelFormat  format,
+		 GString          *row,
+		 guint32           group,
+		 const gchar      *key,
+		 xkb_keycode_t     keycode,
+		 int               level,
+		 const ModelEntry *entry)
+{
+	const gchar *label = model->tables->strings + entry->label;
+	const xkb_keysym_t *keysyms = &model->tables->keysyms[entry->keysyms];
+	gchar name[64];
+	guint32 i;
+
+	if (format == TECLA_MODEL_FORMAT_JSON) {
+		g_string_append_printf (row, "{\"level\":%d,\"keysyms\":[", level + 1);
+
+		for (i = 0; i < entry->n_keysyms; i++) {
+			if (xkb_keysym_get_name (keysyms[i], name, sizeof (name)) < 0)
+				g_snprintf (name, sizeof (name), "0x%x", keysyms[i]);
+
+			if (i > 0)
+				g_string_append_c (row, ',');
+			append_json_string (row, name);
+		}
+
+		g_string_append (row, "],\"codepoints\":[");
+
+		for (i = 0; i < entry->n_keysyms; i++) {
+			uint32_t uc = xkb_keysym_to_utf32 (keysyms[i]);
+
+			if (i > 0)
+				g_string_append_c (row, ',');
+
+			if (uc != 0)
+				g_string_append_printf (row, "%u", uc);
+			else
+				g_string_append (row, "null");
+		}
+
+		g_string_append (row, "],\"label\":");
+		append_json_string (row, label);
+		g_string_append_c (row, '}');
+	} else {
+		g_string_append_printf (row, "%u\t%s\t%u\t%d\t",
+					group + 1, key, keycode, level + 1);
+
+		/* Sequences are space separated within their column */
+		for (i = 0; i < entry->n_keysyms; i++) {
+			if (xkb_keysym_get_name (keysyms[i], name, sizeof (name)) < 0)
+				g_snprintf (name, sizeof (name), "0x%x", keysyms[i]);
+
+			g_string_append_printf (row, "%s%s", i > 0 ? " " : "", name);
+		}
+
+		g_string_append_c (row, '\t');
+
+		for (i = 0; i < entry->n_keysyms; i++) {
+			uint32_t uc = xkb_keysym_to_utf32 (keysyms[i]);
+
+			if (i > 0)
+				g_string_append_c (row, ' ');
+
+			if (uc != 0)
+				g_string_append_printf (row, "U+%04X", uc);
+		}
+
+		g_string_append_printf (row, "\t%s\n", label);
+	}
+}
+
+gboolean
+tecla_model_serialize (TeclaModel        *model,
+		       TeclaModelFormat   format,
+		       GOutputStream     *stream,
+		       GError           **error)
+{
+	g_autoptr (GString) row = NULL;
+	guint32 group;
+	gulong i, j;
+
+	g_return_val_if_fail (TECLA_IS_MODEL (model), FALSE);
+	g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), FALSE);
+
+	row = g_string_new (NULL);
+
+	if (format == TECLA_MODEL_FORMAT_JSON)
+		g_string_append (row, "{\"groups\":[");
+	else
+		g_string_append (row, "group\tkey\tkeycode\tlevel\tkeysyms\tcodepoints\tlabel\n");
+
+	for (group = 0; group < model->tables->header->n_groups; group++) {
+		gboolean first_key = TRUE;
+
+		if (format == TECLA_MODEL_FORMAT_JSON) {
+			g_string_append_printf (row, "%s{\"group\":%u,\"name\":",
+						group > 0 ? "," : "", group + 1);
+			append_json_string (row, model->tables->strings + model->tables->groups[group].name);
+			g_string_append (row, ",\"keys\":[");
+		}
+
+		for (i = 0; i < G_N_ELEMENTS (pc105_layout.rows); i++) {
+			for (j = 0; j < G_N_ELEMENTS (pc105_layout.rows[i].keys); j++) {
+				TeclaLayoutKey *key;
+				xkb_keycode_t keycode;
+				gboolean first_level = TRUE;
+				int level;
+
+				key = &pc105_layout.rows[i].keys[j];
+				if (!key->name)
+					break;
+				/* Keys spanning several rows are only listed once */
+				if (key->height < 0)
+					continue;
+
+				keycode = tecla_model_get_key_keycode (model, key->name);
+				if (keycode == XKB_KEYCODE_INVALID)
+					continue;
+
+				if (format == TECLA_MODEL_FORMAT_JSON) {
+					g_string_append (row, first_key ? "{\"name\":" : ",{\"name\":");
+					append_json_string (row, key->name);
+					g_string_append_printf (row, ",\"keycode\":%u,\"levels\":[",
+								keycode);
+					first_key = FALSE;
+				}
+
+				for (level = 0; level < N_LEVELS; level++) {
+					const ModelEntry *entry;
+
+					entry = get_entry (model, group, level, keycode);
+					if (!entry || entry->keysym == 0)
+						continue;
+
+					if (format == TECLA_MODEL_FORMAT_JSON && !first_level)
+						g_string_append_c (row, ',');
+					first_level = FALSE;
+
+					serialize_level (model, format, row, group, key->name,
+							 keycode, level, entry);
+
+					if (!flush_row (stream, row, error))
+						return FALSE;
+				}
+
+				if (format == TECLA_MODEL_FORMAT_JSON)
+					g_string_append (row, "]}");
+			}
+		}
+
+		if (format == TECLA_MODEL_FORMAT_JSON)
+			g_string_append (row, "]}");
+	}
+
+	if (format == TECLA_MODEL_FORMAT_JSON)
+		g_string_append (row, "]}\n");
+
+	return flush_row (stream, row, error);
+}
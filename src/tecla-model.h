@@ -21,30 +21,136 @@
 #include <gtk/gtk.h>
 #include <xkbcommon/xkbcommon.h>
 
+#include "tecla-macros.h"
+
 #pragma once
 
+typedef enum
+{
+	TECLA_MODEL_FORMAT_JSON,
+	TECLA_MODEL_FORMAT_TSV,
+} TeclaModelFormat;
+
+typedef enum
+{
+	TECLA_MODEL_KEY_NONE   = 0,
+	TECLA_MODEL_KEY_LEVEL2 = 1 << 0,
+	TECLA_MODEL_KEY_LEVEL3 = 1 << 1,
+	TECLA_MODEL_KEY_LEVEL5 = 1 << 2,
+} TeclaModelKeyModifier;
+
+/**
+ * TeclaModelKeyPosition:
+ * @keycode: (type guint32): the keycode of the key
+ * @group: the group the key is found in
+ * @level: the level to press the key at
+ * @dead_keycode: (type guint32): the dead key to press beforehand, or 0
+ * @dead_level: the level to press the dead key at
+ */
+typedef struct
+{
+	xkb_keycode_t keycode;
+	int group;
+	int level;
+	/* Dead key to press beforehand, or 0 */
+	xkb_keycode_t dead_keycode;
+	int dead_level;
+} TeclaModelKeyPosition;
+
+/**
+ * TeclaModelKeysymFunc:
+ * @keycode: (type guint32): the keycode of the key
+ * @group: the group of the level
+ * @level: the level of the key
+ * @keysym: (type guint32): the keysym at that level
+ * @user_data: the data passed to tecla_model_foreach_keysym()
+ */
+typedef void (* TeclaModelKeysymFunc) (xkb_keycode_t keycode,
+				       int           group,
+				       int           level,
+				       xkb_keysym_t  keysym,
+				       gpointer      user_data);
+
 #define TECLA_TYPE_MODEL (tecla_model_get_type ())
+TECLA_EXPORT
 G_DECLARE_FINAL_TYPE (TeclaModel, tecla_model, TECLA, MODEL, GObject)
 
+TECLA_EXPORT
 TeclaModel * tecla_model_new_from_xkb_keymap (struct xkb_keymap *xkb_keymap);
 
-TeclaModel * tecla_model_new_from_layout_name (const gchar *layout);
+TECLA_EXPORT
+TeclaModel * tecla_model_new_from_layout_name (const gchar *name);
+
+TECLA_EXPORT
+guint64 tecla_model_get_layout_stamp (const gchar *layout);
+
+TECLA_EXPORT
+gchar * tecla_model_build_layout_name (const gchar *layouts,
+				       const gchar *variants,
+				       const gchar *options);
 
+TECLA_EXPORT
 const gchar * tecla_model_get_keycode_key (TeclaModel    *model,
 					   xkb_keycode_t  keycode);
 
+TECLA_EXPORT
 xkb_keycode_t tecla_model_get_key_keycode (TeclaModel  *model,
 					   const gchar *key);
 
-gchar * tecla_model_get_key_label (TeclaModel  *model,
-				   int          level,
-				   const gchar *key);
+TECLA_EXPORT
+const gchar * tecla_model_get_key_label (TeclaModel  *model,
+					 int          level,
+					 const gchar *key);
 
+TECLA_EXPORT
 guint tecla_model_get_keyval (TeclaModel    *model,
 			      int            level,
 			      xkb_keycode_t  keycode);
 
+TECLA_EXPORT
+const xkb_keysym_t * tecla_model_get_keysyms (TeclaModel    *model,
+					      int            level,
+					      xkb_keycode_t  keycode,
+					      int           *n_keysyms);
+
+TECLA_EXPORT
+TeclaModelKeyModifier tecla_model_get_key_modifier (TeclaModel    *model,
+						    xkb_keycode_t  keycode);
+
+TECLA_EXPORT
 const gchar * tecla_model_get_name (TeclaModel *model);
 
+TECLA_EXPORT
+guint tecla_model_get_n_groups (TeclaModel *model);
+
+TECLA_EXPORT
+const gchar * tecla_model_get_group_name (TeclaModel *model,
+					  guint       group);
+
+TECLA_EXPORT
+int tecla_model_get_group (TeclaModel *model);
+
+TECLA_EXPORT
 void tecla_model_set_group (TeclaModel *model,
 			    int         group);
+
+TECLA_EXPORT
+gboolean tecla_model_find_keysym (TeclaModel            *model,
+				  xkb_keysym_t           keysym,
+				  TeclaModelKeyPosition *position);
+
+TECLA_EXPORT
+gboolean tecla_model_find_char (TeclaModel            *model,
+				gunichar               ch,
+				TeclaModelKeyPosition *position);
+
+TECLA_EXPORT
+void tecla_model_foreach_keysym (TeclaModel           *model,
+				 TeclaModelKeysymFunc  func,
+				 gpointer              user_data);
+
+TECLA_EXPORT
+gboolean tecla_model_serialize (TeclaModel        *model,
+				TeclaModelFormat   format,
+				GOutputStream     *stream,
+				GError           **error);
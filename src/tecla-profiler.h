@@ -0,0 +1,41 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+/* Sysprof capture marks, these compile to nothing unless tecla is
+ * configured with -Dprofiling=true. A mark spans from
+ * TECLA_PROFILER_BEGIN_MARK to TECLA_PROFILER_END_MARK in the same
+ * scope, the message takes printf() style arguments.
+ */
+#ifdef HAVE_SYSPROF
+#include <sysprof-capture.h>
+
+#define TECLA_PROFILER_BEGIN_MARK \
+	gint64 tecla_profiler_begin = SYSPROF_CAPTURE_CURRENT_TIME
+
+#define TECLA_PROFILER_END_MARK(name, ...) \
+	sysprof_collector_mark_printf (tecla_profiler_begin, \
+				       SYSPROF_CAPTURE_CURRENT_TIME - tecla_profiler_begin, \
+				       "tecla", name, __VA_ARGS__)
+#else
+#define TECLA_PROFILER_BEGIN_MARK
+#define TECLA_PROFILER_END_MARK(name, ...) G_STMT_START { } G_STMT_END
+#endif
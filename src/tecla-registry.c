@@ -0,0 +1,611 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include "tecla-registry.h"
+
+#include <errno.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "tecla-util.h"
+
+/* Bump whenever the cache contents change */
+#define REGISTRY_VERSION 1
+#define REGISTRY_FORMAT "(uta(ssssas))"
+
+#define N_SUGGESTIONS 3
+
+enum
+{
+	MATCH_EXACT,
+	MATCH_NAME_PREFIX,
+	MATCH_NAME,
+	MATCH_DESCRIPTION,
+	MATCH_FUZZY,
+};
+
+typedef struct
+{
+	guint score;
+	guint index;
+} SearchResult;
+
+struct _TeclaRegistry
+{
+	GObject parent_instance;
+	GVariant *data;
+	GArray *layouts; /* TeclaRegistryLayout */
+	GHashTable *layouts_by_name;
+};
+
+G_DEFINE_TYPE (TeclaRegistry, tecla_registry, G_TYPE_OBJECT)
+G_DEFINE_BOXED_TYPE (TeclaRegistryLayout, tecla_registry_layout,
+		     tecla_registry_layout_copy, tecla_registry_layout_free)
+
+/**
+ * tecla_registry_layout_copy:
+ *
+ * Layouts returned by the registry point into its data, copies own
+ * their strings.
+ *
+ * Returns: (transfer full): a copy of @layout
+ */
+TeclaRegistryLayout *
+tecla_registry_layout_copy (const TeclaRegistryLayout *layout)
+{
+	TeclaRegistryLayout *copy;
+
+	g_return_val_if_fail (layout != NULL, NULL);
+
+	copy = g_new0 (TeclaRegistryLayout, 1);
+	copy->name = g_strdup (layout->name);
+	copy->description = g_strdup (layout->description);
+	copy->brief = g_strdup (layout->brief);
+	copy->search_key = g_strdup (layout->search_key);
+	copy->languages = (const gchar **) g_strdupv ((gchar **) layout->languages);
+
+	return copy;
+}
+
+/**
+ * tecla_registry_layout_free:
+ *
+ * Frees a layout returned by tecla_registry_layout_copy().
+ */
+void
+tecla_registry_layout_free (TeclaRegistryLayout *layout)
+{
+	g_return_if_fail (layout != NULL);
+
+	g_free ((gchar *) layout->name);
+	g_free ((gchar *) layout->description);
+	g_free ((gchar *) layout->brief);
+	g_free ((gchar *) layout->search_key);
+	g_strfreev ((gchar **) layout->languages);
+	g_free (layout);
+}
+
+static void
+tecla_registry_finalize (GObject *object)
+{
+	TeclaRegistry *registry = TECLA_REGISTRY (object);
+
+	g_hash_table_unref (registry->layouts_by_name);
+	g_array_unref (registry->layouts);
+	g_variant_unref (registry->data);
+
+	G_OBJECT_CLASS (tecla_registry_parent_class)->finalize (object);
+}
+
+static void
+tecla_registry_class_init (TeclaRegistryClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = tecla_registry_finalize;
+}
+
+static void
+layout_clear (TeclaRegistryLayout *layout)
+{
+	g_free (layout->languages);
+}
+
+static void
+tecla_registry_init (TeclaRegistry *registry)
+{
+	registry->layouts = g_array_new (FALSE, FALSE, sizeof (TeclaRegistryLayout));
+	g_array_set_clear_func (registry->layouts, (GDestroyNotify) layout_clear);
+	registry->layouts_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+}
+
+static gchar *
+get_cache_path (void)
+{
+	return g_build_filename (g_get_user_cache_dir (),
+				 "tecla", "registry.gvariant", NULL);
+}
+
+static GVariant *
+load_cache (const gchar *path,
+	    guint64      stamp)
+{
+	g_autoptr (GMappedFile) mapped_file = NULL;
+	g_autoptr (GBytes) bytes = NULL;
+	g_autoptr (GVariant) data = NULL;
+	guint32 version;
+	guint64 cache_stamp;
+
+	mapped_file = g_mapped_file_new (path, FALSE, NULL);
+	if (!mapped_file)
+		return NULL;
+
+	/* Untrusted data is safe to access, malformed parts read as empty */
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	data = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (REGISTRY_FORMAT),
+							     bytes, FALSE));
+
+	g_variant_get_child (data, 0, "u", &version);
+	g_variant_get_child (data, 1, "t", &cache_stamp);
+	if (version != REGISTRY_VERSION || cache_stamp != stamp)
+		return NULL;
+
+	return g_steal_pointer (&data);
+}
+
+static GVariant *
+build_cache (guint64 stamp)
+{
+	struct rxkb_context *rxkb_context;
+	struct rxkb_layout *layout;
+	GVariantBuilder builder;
+
+	rxkb_context = tecla_util_create_rxkb_context ();
+	if (!rxkb_context_parse (rxkb_context, "evdev")) {
+		g_warning ("Could not parse the XKB registry");
+		rxkb_context_unref (rxkb_context);
+		return NULL;
+	}
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssssas)"));
+
+	for (layout = rxkb_layout_first (rxkb_context);
+	     layout;
+	     layout = rxkb_layout_next (layout)) {
+		g_autofree gchar *name = NULL;
+		g_autofree gchar *search_key = NULL;
+		g_autoptr (GString) str = NULL;
+		const gchar *variant, *description, *brief;
+		struct rxkb_iso639_code *code;
+		GVariantBuilder languages;
+
+		variant = rxkb_layout_get_variant (layout);
+		description = rxkb_layout_get_description (layout);
+		brief = rxkb_layout_get_brief (layout);
+
+		if (variant && *variant) {
+			name = g_strdup_printf ("%s+%s",
+						rxkb_layout_get_name (layout),
+						variant);
+		} else {
+			name = g_strdup (rxkb_layout_get_name (layout));
+		}
+
+		str = g_string_new (name);
+		if (description)
+			g_string_append_printf (str, " %s", description);
+		if (brief)
+			g_string_append_printf (str, " %s", brief);
+
+		g_variant_builder_init (&languages, G_VARIANT_TYPE_STRING_ARRAY);
+
+		for (code = rxkb_layout_get_iso639_first (layout);
+		     code;
+		     code = rxkb_iso639_code_next (code)) {
+			const gchar *language = rxkb_iso639_code_get_code (code);
+
+			g_variant_builder_add (&languages, "s", language);
+			g_string_append_printf (str, " %s", language);
+		}
+
+		search_key = g_utf8_casefold (str->str, -1);
+		g_variant_builder_add (&builder, "(ssssas)",
+				       name,
+				       description ? description : "",
+				       brief ? brief : "",
+				       search_key,
+				       &languages);
+	}
+
+	rxkb_context_unref (rxkb_context);
+
+	return g_variant_ref_sink (g_variant_new ("(ut@a(ssssas))",
+						  REGISTRY_VERSION, stamp,
+						  g_variant_builder_end (&builder)));
+}
+
+static void
+save_cache (const gchar *path,
+	    GVariant    *data)
+{
+	g_autofree gchar *dir = NULL;
+	g_autoptr (GError) error = NULL;
+
+	dir = g_path_get_dirname (path);
+	if (g_mkdir_with_parents (dir, 0700) < 0) {
+		g_debug ("Could not create %s: %s", dir, g_strerror (errno));
+		return;
+	}
+
+	if (!g_file_set_contents (path, g_variant_get_data (data),
+				  g_variant_get_size (data), &error))
+		g_debug ("Could not save registry cache: %s", error->message);
+}
+
+static void
+load_layouts (TeclaRegistry *registry)
+{
+	g_autoptr (GVariant) entries = NULL;
+	gsize i, n_entries;
+
+	entries = g_variant_get_child_value (registry->data, 2);
+	n_entries = g_variant_n_children (entries);
+
+	for (i = 0; i < n_entries; i++) {
+		TeclaRegistryLayout layout;
+
+		/* Strings point into the serialized data */
+		g_variant_get_child (entries, i, "(&s&s&s&s^a&s)",
+				     &layout.name,
+				     &layout.description,
+				     &layout.brief,
+				     &layout.search_key,
+				     &layout.languages);
+
+		if (!*layout.name ||
+		    g_hash_table_contains (registry->layouts_by_name,
+					   layout.name)) {
+			g_free (layout.languages);
+			continue;
+		}
+
+		g_hash_table_insert (registry->layouts_by_name,
+				     (gpointer) layout.name,
+				     GUINT_TO_POINTER (registry->layouts->len));
+		g_array_append_val (registry->layouts, layout);
+	}
+}
+
+static TeclaRegistry *
+tecla_registry_new (void)
+{
+	TeclaRegistry *registry;
+	g_autofree gchar *path = NULL;
+	guint64 stamp;
+
+	registry = g_object_new (TECLA_TYPE_REGISTRY, NULL);
+
+	stamp = tecla_util_get_registry_stamp ();
+	path = get_cache_path ();
+
+	registry->data = load_cache (path, stamp);
+
+	if (!registry->data) {
+		registry->data = build_cache (stamp);
+
+		if (registry->data) {
+			save_cache (path, registry->data);
+		} else {
+			registry->data =
+				g_variant_ref_sink (g_variant_new_parsed ("(%u, @t 0, @a(ssssas) [])",
+									  REGISTRY_VERSION));
+		}
+	}
+
+	load_layouts (registry);
+
+	return registry;
+}
+
+/**
+ * tecla_registry_get_default:
+ *
+ * Returns: (transfer none): the registry of installed layouts
+ */
+TeclaRegistry *
+tecla_registry_get_default (void)
+{
+	static TeclaRegistry *registry = NULL;
+
+	/* Immutable once loaded, so it may be shared by all threads */
+	if (g_once_init_enter (&registry))
+		g_once_init_leave (&registry, tecla_registry_new ());
+
+	return registry;
+}
+
+guint
+tecla_registry_get_n_layouts (TeclaRegistry *registry)
+{
+	return registry->layouts->len;
+}
+
+/**
+ * tecla_registry_get_layout:
+ *
+ * Returns: (transfer none): the layout at @index, owned by @registry
+ */
+const TeclaRegistryLayout *
+tecla_registry_get_layout (TeclaRegistry *registry,
+			   guint          index)
+{
+	g_return_val_if_fail (index < registry->layouts->len, NULL);
+
+	return &g_array_index (registry->layouts, TeclaRegistryLayout, index);
+}
+
+static gchar *
+normalize_name (const gchar *name)
+{
+	gchar *normalized;
+
+	/* Accept the same separators as tecla_model_new_from_layout_name() */
+	normalized = g_strstrip (g_strdup (name));
+	g_strdelimit (normalized, " \t", '+');
+
+	return normalized;
+}
+
+/**
+ * tecla_registry_lookup:
+ *
+ * Returns: (transfer none) (nullable): the layout named @name, owned
+ *   by @registry
+ */
+const TeclaRegistryLayout *
+tecla_registry_lookup (TeclaRegistry *registry,
+		       const gchar   *name)
+{
+	g_autofree gchar *normalized = NULL;
+	gpointer index;
+
+	normalized = normalize_name (name);
+	if (!g_hash_table_lookup_extended (registry->layouts_by_name,
+					   normalized, NULL, &index))
+		return NULL;
+
+	return tecla_registry_get_layout (registry, GPOINTER_TO_UINT (index));
+}
+
+static gboolean
+fuzzy_match (const gchar *key,
+	     const gchar *query,
+	     guint       *gaps)
+{
+	gboolean started = FALSE;
+
+	*gaps = 0;
+
+	/* Subsequence match, counting characters skipped in between */
+	while (*query && *key) {
+		if (g_utf8_get_char (key) == g_utf8_get_char (query)) {
+			query = g_utf8_next_char (query);
+			started = TRUE;
+		} else if (started) {
+			(*gaps)++;
+		}
+
+		key = g_utf8_next_char (key);
+	}
+
+	return *query == '\0';
+}
+
+static gboolean
+score_layout (const TeclaRegistryLayout *layout,
+	      const gchar               *query,
+	      guint                     *score)
+{
+	const gchar *match;
+	guint gaps;
+
+	match = strstr (layout->name, query);
+	if (match == layout->name) {
+		*score = layout->name[strlen (query)] == '\0' ?
+			MATCH_EXACT : MATCH_NAME_PREFIX;
+	} else if (match) {
+		*score = MATCH_NAME;
+	} else if (strstr (layout->search_key, query)) {
+		*score = MATCH_DESCRIPTION;
+	} else if (fuzzy_match (layout->search_key, query, &gaps)) {
+		*score = MATCH_FUZZY + gaps;
+	} else {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static int
+compare_results (const SearchResult *a,
+		 const SearchResult *b)
+{
+	if (a->score != b->score)
+		return a->score < b->score ? -1 : 1;
+
+	return a->index < b->index ? -1 : a->index > b->index;
+}
+
+/**
+ * tecla_registry_search:
+ *
+ * Returns: (transfer container) (element-type TeclaRegistryLayout):
+ *   the matching layouts, best first
+ */
+GPtrArray *
+tecla_registry_search (TeclaRegistry *registry,
+		       const gchar   *query,
+		       guint          max_results)
+{
+	g_autoptr (GArray) results = NULL;
+	g_autofree gchar *folded = NULL;
+	GPtrArray *layouts;
+	guint i;
+
+	layouts = g_ptr_array_new ();
+	folded = g_utf8_casefold (query, -1);
+	g_strstrip (folded);
+
+	if (!*folded)
+		return layouts;
+
+	results = g_array_new (FALSE, FALSE, sizeof (SearchResult));
+
+	for (i = 0; i < registry->layouts->len; i++) {
+		SearchResult result = { 0, i };
+
+		if (score_layout (tecla_registry_get_layout (registry, i),
+				  folded, &result.score))
+			g_array_append_val (results, result);
+	}
+
+	g_array_sort (results, (GCompareFunc) compare_results);
+
+	for (i = 0; i < results->len && (max_results == 0 || i < max_results); i++) {
+		SearchResult *result = &g_array_index (results, SearchResult, i);
+
+		g_ptr_array_add (layouts,
+				 (gpointer) tecla_registry_get_layout (registry,
+								       result->index));
+	}
+
+	return layouts;
+}
+
+static guint
+edit_distance (const gchar *a,
+	       const gchar *b)
+{
+	g_autofree guint *row = NULL;
+	gsize len_a, len_b, i, j;
+
+	len_a = strlen (a);
+	len_b = strlen (b);
+	row = g_new (guint, len_b + 1);
+
+	for (j = 0; j <= len_b; j++)
+		row[j] = j;
+
+	/* Levenshtein distance, keeping a single row of the matrix */
+	for (i = 1; i <= len_a; i++) {
+		guint diagonal = row[0];
+
+		row[0] = i;
+
+		for (j = 1; j <= len_b; j++) {
+			guint above = row[j];
+
+			row[j] = MIN (MIN (row[j] + 1, row[j - 1] + 1),
+				      diagonal + (a[i - 1] != b[j - 1]));
+			diagonal = above;
+		}
+	}
+
+	return row[len_b];
+}
+
+/**
+ * tecla_registry_suggest:
+ *
+ * Returns: (transfer container) (element-type TeclaRegistryLayout):
+ *   the layouts with names closest to @name, best first
+ */
+GPtrArray *
+tecla_registry_suggest (TeclaRegistry *registry,
+			const gchar   *name,
+			guint          max_results)
+{
+	g_autoptr (GArray) results = NULL;
+	g_autofree gchar *normalized = NULL;
+	GPtrArray *layouts;
+	guint i, max_distance;
+
+	normalized = normalize_name (name);
+	max_distance = MAX (strlen (normalized) / 3, 1);
+	results = g_array_new (FALSE, FALSE, sizeof (SearchResult));
+
+	for (i = 0; i < registry->layouts->len; i++) {
+		const TeclaRegistryLayout *layout;
+		SearchResult result = { 0, i };
+
+		layout = tecla_registry_get_layout (registry, i);
+		result.score = edit_distance (normalized, layout->name);
+
+		if (result.score <= max_distance)
+			g_array_append_val (results, result);
+	}
+
+	/* Nothing close in spelling, fall back to searching descriptions */
+	if (results->len == 0)
+		return tecla_registry_search (registry, name, max_results);
+
+	g_array_sort (results, (GCompareFunc) compare_results);
+	layouts = g_ptr_array_new ();
+
+	for (i = 0; i < results->len && (max_results == 0 || i < max_results); i++) {
+		SearchResult *result = &g_array_index (results, SearchResult, i);
+
+		g_ptr_array_add (layouts,
+				 (gpointer) tecla_registry_get_layout (registry,
+								       result->index));
+	}
+
+	return layouts;
+}
+
+gchar *
+tecla_registry_format_suggestions (TeclaRegistry *registry,
+				   const gchar   *name)
+{
+	g_autoptr (GPtrArray) suggestions = NULL;
+	g_autoptr (GString) str = NULL;
+	guint i;
+
+	str = g_string_new (NULL);
+	g_string_printf (str, _("Unknown layout “%s”"), name);
+
+	suggestions = tecla_registry_suggest (registry, name, N_SUGGESTIONS);
+
+	for (i = 0; i < suggestions->len; i++) {
+		const TeclaRegistryLayout *layout = suggestions->pdata[i];
+
+		g_string_append (str, i == 0 ? _(", did you mean ") : ", ");
+		g_string_append_printf (str, "“%s” (%s)",
+					layout->name, layout->description);
+	}
+
+	if (suggestions->len > 0)
+		g_string_append (str, "?");
+
+	return g_string_free (g_steal_pointer (&str), FALSE);
+}
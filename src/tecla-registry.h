@@ -0,0 +1,90 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <glib-object.h>
+
+#include "tecla-macros.h"
+
+#pragma once
+
+typedef struct _TeclaRegistryLayout TeclaRegistryLayout;
+
+/**
+ * TeclaRegistryLayout:
+ * @name: the layout name, "layout" or "layout+variant"
+ * @description: the human readable description
+ * @brief: the short description, or an empty string
+ * @search_key: casefolded text matched by searches
+ * @languages: (array zero-terminated=1): ISO 639 language codes
+ */
+struct _TeclaRegistryLayout
+{
+	const gchar *name; /* "layout" or "layout+variant" */
+	const gchar *description;
+	const gchar *brief;
+	const gchar *search_key;
+	const gchar **languages;
+};
+
+#define TECLA_TYPE_REGISTRY_LAYOUT (tecla_registry_layout_get_type ())
+TECLA_EXPORT
+GType tecla_registry_layout_get_type (void) G_GNUC_CONST;
+
+TECLA_EXPORT
+TeclaRegistryLayout * tecla_registry_layout_copy (const TeclaRegistryLayout *layout);
+
+TECLA_EXPORT
+void tecla_registry_layout_free (TeclaRegistryLayout *layout);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (TeclaRegistryLayout, tecla_registry_layout_free)
+
+#define TECLA_TYPE_REGISTRY (tecla_registry_get_type ())
+TECLA_EXPORT
+G_DECLARE_FINAL_TYPE (TeclaRegistry, tecla_registry,
+		      TECLA, REGISTRY,
+		      GObject)
+
+TECLA_EXPORT
+TeclaRegistry * tecla_registry_get_default (void);
+
+TECLA_EXPORT
+guint tecla_registry_get_n_layouts (TeclaRegistry *registry);
+
+TECLA_EXPORT
+const TeclaRegistryLayout * tecla_registry_get_layout (TeclaRegistry *registry,
+						       guint          index);
+
+TECLA_EXPORT
+const TeclaRegistryLayout * tecla_registry_lookup (TeclaRegistry *registry,
+						   const gchar   *name);
+
+TECLA_EXPORT
+GPtrArray * tecla_registry_search (TeclaRegistry *registry,
+				   const gchar   *query,
+				   guint          max_results);
+
+TECLA_EXPORT
+GPtrArray * tecla_registry_suggest (TeclaRegistry *registry,
+				    const gchar   *name,
+				    guint          max_results);
+
+TECLA_EXPORT
+gchar * tecla_registry_format_suggestions (TeclaRegistry *registry,
+					   const gchar   *name);
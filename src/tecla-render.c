@@ -0,0 +1,365 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tecla-render.h"
+
+#include <gtk/gtk.h>
+
+#include "tecla-view.h"
+
+#define N_FRAMES 20
+
+/* Per channel, to allow for small antialiasing differences */
+#define PIXEL_TOLERANCE 2
+
+/* Maximum time for the window to be shown at a new size */
+#define WAIT_TIMEOUT (5 * G_USEC_PER_SEC)
+
+typedef struct
+{
+	int width;
+	int height;
+} RenderConfig;
+
+/* The scale factor is the one of the display, e.g. GDK_SCALE on X11 */
+static const RenderConfig render_configs[] = {
+	{ 640, 240 },
+	{ 800, 300 },
+	{ 1200, 450 },
+};
+
+typedef struct
+{
+	GtkWidget *view;
+	const RenderConfig *config;
+	gboolean painted;
+} WaitData;
+
+typedef gboolean (* WaitFunc) (WaitData *data);
+
+static gboolean
+wake_up_cb (gpointer user_data)
+{
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+wait_for (WaitFunc   func,
+	  WaitData  *data)
+{
+	gint64 deadline;
+	guint source_id;
+
+	deadline = g_get_monotonic_time () + WAIT_TIMEOUT;
+	source_id = g_timeout_add (100, wake_up_cb, NULL);
+
+	while (!func (data) && g_get_monotonic_time () < deadline)
+		g_main_context_iteration (NULL, TRUE);
+
+	g_source_remove (source_id);
+
+	return func (data);
+}
+
+static gboolean
+is_allocated (WaitData *data)
+{
+	return gtk_widget_get_mapped (data->view) &&
+		gtk_widget_get_width (data->view) == data->config->width &&
+		gtk_widget_get_height (data->view) == data->config->height;
+}
+
+static gboolean
+is_painted (WaitData *data)
+{
+	return data->painted;
+}
+
+static void
+after_paint_cb (GdkFrameClock *frame_clock,
+		WaitData      *data)
+{
+	data->painted = TRUE;
+}
+
+static gboolean
+show_view (GtkWindow           *window,
+	   TeclaView           *view,
+	   const RenderConfig  *config,
+	   GError             **error)
+{
+	WaitData data = { GTK_WIDGET (view), config, FALSE };
+	GdkFrameClock *frame_clock;
+	gulong handler_id;
+
+	gtk_widget_set_size_request (GTK_WIDGET (view),
+				     config->width, config->height);
+	gtk_window_set_default_size (window, config->width, config->height);
+	gtk_window_present (window);
+
+	if (!wait_for (is_allocated, &data)) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+			     "Could not show the view at %dx%d",
+			     config->width, config->height);
+		return FALSE;
+	}
+
+	/* Styles and layout are only final once a frame was painted */
+	frame_clock = gtk_widget_get_frame_clock (GTK_WIDGET (view));
+	handler_id = g_signal_connect (frame_clock, "after-paint",
+				       G_CALLBACK (after_paint_cb), &data);
+	gtk_widget_queue_draw (GTK_WIDGET (view));
+
+	wait_for (is_painted, &data);
+	g_signal_handler_disconnect (frame_clock, handler_id);
+
+	if (!data.painted) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+				     "The view was not painted");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static GdkTexture *
+render_view (GdkPaintable *paintable,
+	     GskRenderer  *renderer,
+	     int           width,
+	     int           height)
+{
+	GtkSnapshot *snapshot;
+	GskRenderNode *node;
+	GdkTexture *texture;
+	graphene_rect_t bounds;
+
+	graphene_rect_init (&bounds, 0, 0, width, height);
+
+	/* Sized in device pixels, the paintable scales the view's own
+	 * render node to fit.
+	 */
+	snapshot = gtk_snapshot_new ();
+	gtk_snapshot_append_color (snapshot, &(GdkRGBA) { 1, 1, 1, 1 }, &bounds);
+	gdk_paintable_snapshot (paintable, snapshot, width, height);
+	node = gtk_snapshot_free_to_node (snapshot);
+
+	texture = gsk_renderer_render_texture (renderer, node, &bounds);
+	gsk_render_node_unref (node);
+
+	return texture;
+}
+
+static guchar *
+download_texture (GdkTexture *texture)
+{
+	guchar *data;
+
+	data = g_malloc (gdk_texture_get_width (texture) *
+			 gdk_texture_get_height (texture) * 4);
+	gdk_texture_download (texture, data, gdk_texture_get_width (texture) * 4);
+
+	return data;
+}
+
+/* Returns the number of pixels differing beyond the tolerance */
+static guint
+compare_textures (GdkTexture *texture,
+		  GdkTexture *reference)
+{
+	g_autofree guchar *data = NULL, *reference_data = NULL;
+	gsize i, n_pixels;
+	guint n_different = 0;
+
+	if (gdk_texture_get_width (texture) != gdk_texture_get_width (reference) ||
+	    gdk_texture_get_height (texture) != gdk_texture_get_height (reference))
+		return G_MAXUINT;
+
+	data = download_texture (texture);
+	reference_data = download_texture (reference);
+	n_pixels = (gsize) gdk_texture_get_width (texture) *
+		gdk_texture_get_height (texture);
+
+	for (i = 0; i < n_pixels; i++) {
+		int c;
+
+		for (c = 0; c < 4; c++) {
+			if (ABS (data[i * 4 + c] - reference_data[i * 4 + c]) >
+			    PIXEL_TOLERANCE) {
+				n_different++;
+				break;
+			}
+		}
+	}
+
+	return n_different;
+}
+
+static gboolean
+check_config (GtkWindow           *window,
+	      TeclaView           *view,
+	      GFile               *dir,
+	      const gchar         *layout,
+	      const RenderConfig  *config,
+	      gboolean             update,
+	      GError             **error)
+{
+	g_autoptr (GdkPaintable) paintable = NULL;
+	g_autoptr (GdkTexture) texture = NULL;
+	g_autoptr (GdkTexture) reference = NULL;
+	g_autoptr (GFile) file = NULL;
+	g_autofree gchar *filename = NULL;
+	GskRenderer *renderer;
+	gint64 total = 0, max = 0;
+	guint n_different, i;
+	int scale;
+
+	if (!show_view (window, view, config, error))
+		return FALSE;
+
+	/* The renderer of the window, GSK_RENDERER picks which one */
+	renderer = gtk_native_get_renderer (GTK_NATIVE (window));
+	scale = gtk_widget_get_scale_factor (GTK_WIDGET (view));
+	paintable = gtk_widget_paintable_new (GTK_WIDGET (view));
+
+	for (i = 0; i < N_FRAMES; i++) {
+		gint64 start, elapsed;
+
+		g_clear_object (&texture);
+
+		start = g_get_monotonic_time ();
+		texture = render_view (paintable, renderer,
+				       config->width * scale,
+				       config->height * scale);
+		elapsed = g_get_monotonic_time () - start;
+
+		total += elapsed;
+		max = MAX (max, elapsed);
+	}
+
+	filename = g_strdup_printf ("%s-%dx%d@%d.png", layout,
+				    config->width, config->height, scale);
+	file = g_file_get_child (dir, filename);
+
+	g_print ("%s: %.2f ms/frame, max %.2f ms",
+		 filename, total / 1000.0 / N_FRAMES, max / 1000.0);
+
+	if (update) {
+		g_print ("\n");
+
+		if (!gdk_texture_save_to_png (texture, g_file_peek_path (file))) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+				     "Could not save %s", g_file_peek_path (file));
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
+	reference = gdk_texture_new_from_file (file, error);
+	if (!reference) {
+		g_print ("\n");
+		return FALSE;
+	}
+
+	n_different = compare_textures (texture, reference);
+
+	if (n_different == G_MAXUINT) {
+		g_print (", size differs\n");
+		return FALSE;
+	} else if (n_different > 0) {
+		g_print (", %u pixels differ\n", n_different);
+		return FALSE;
+	}
+
+	g_print (", ok\n");
+
+	return TRUE;
+}
+
+gboolean
+tecla_render_check (const gchar  *directory,
+		    const gchar  *layout,
+		    gboolean      update,
+		    GError      **error)
+{
+	g_autoptr (TeclaModel) model = NULL;
+	g_autoptr (GFile) dir = NULL;
+	GtkWidget *window, *view;
+	guint i, n_failed = 0;
+
+	g_return_val_if_fail (directory != NULL, FALSE);
+	g_return_val_if_fail (layout != NULL, FALSE);
+
+	dir = g_file_new_for_commandline_arg (directory);
+	if (update) {
+		g_autoptr (GError) dir_error = NULL;
+
+		if (!g_file_make_directory_with_parents (dir, NULL, &dir_error) &&
+		    !g_error_matches (dir_error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
+			g_propagate_error (error, g_steal_pointer (&dir_error));
+			return FALSE;
+		}
+	}
+
+	/* The view is rendered the same way it is shown on screen */
+	if (!gtk_init_check ()) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_CONNECTED,
+				     "Could not open a display");
+		return FALSE;
+	}
+
+	model = tecla_model_new_from_layout_name (layout);
+	if (!model) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+			     "Could not load layout “%s”", layout);
+		return FALSE;
+	}
+
+	view = tecla_view_new ();
+	tecla_view_set_model (TECLA_VIEW (view), model);
+
+	window = gtk_window_new ();
+	gtk_window_set_decorated (GTK_WINDOW (window), FALSE);
+	gtk_window_set_resizable (GTK_WINDOW (window), TRUE);
+	gtk_window_set_child (GTK_WINDOW (window), view);
+
+	for (i = 0; i < G_N_ELEMENTS (render_configs); i++) {
+		g_autoptr (GError) config_error = NULL;
+
+		if (!check_config (GTK_WINDOW (window), TECLA_VIEW (view), dir,
+				   layout, &render_configs[i], update,
+				   &config_error)) {
+			if (config_error)
+				g_printerr ("%s\n", config_error->message);
+			n_failed++;
+		}
+	}
+
+	gtk_window_destroy (GTK_WINDOW (window));
+
+	if (n_failed > 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     "%u of %u renders failed", n_failed,
+			     (guint) G_N_ELEMENTS (render_configs));
+		return FALSE;
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,352 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tecla-replay.h"
+
+#include <glib/gi18n.h>
+
+#include "tecla-stats.h"
+#include "tecla-view.h"
+
+#define RECORDING_HEADER "# tecla key events 1"
+
+#define VIEW_WIDTH 800
+#define VIEW_HEIGHT 300
+
+typedef struct
+{
+	guint32 time; /* Milliseconds since the first event */
+	guint keycode;
+	gboolean pressed;
+} RecordedEvent;
+
+struct _TeclaKeyRecorder
+{
+	GObject parent_instance;
+	GOutputStream *stream;
+	guint32 first_time;
+	gboolean started;
+};
+
+G_DEFINE_TYPE (TeclaKeyRecorder, tecla_key_recorder, G_TYPE_OBJECT)
+
+static void
+tecla_key_recorder_finalize (GObject *object)
+{
+	TeclaKeyRecorder *recorder = TECLA_KEY_RECORDER (object);
+	g_autoptr (GError) error = NULL;
+
+	if (!g_output_stream_close (recorder->stream, NULL, &error))
+		g_warning ("Could not save key events: %s", error->message);
+
+	g_object_unref (recorder->stream);
+
+	G_OBJECT_CLASS (tecla_key_recorder_parent_class)->finalize (object);
+}
+
+static void
+tecla_key_recorder_class_init (TeclaKeyRecorderClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = tecla_key_recorder_finalize;
+}
+
+static void
+tecla_key_recorder_init (TeclaKeyRecorder *recorder)
+{
+}
+
+TeclaKeyRecorder *
+tecla_key_recorder_new (GFile   *file,
+			GError **error)
+{
+	g_autoptr (GFileOutputStream) file_stream = NULL;
+	g_autoptr (GOutputStream) stream = NULL;
+	TeclaKeyRecorder *recorder;
+
+	g_return_val_if_fail (G_IS_FILE (file), NULL);
+
+	file_stream = g_file_replace (file, NULL, FALSE,
+				      G_FILE_CREATE_REPLACE_DESTINATION,
+				      NULL, error);
+	if (!file_stream)
+		return NULL;
+
+	stream = g_buffered_output_stream_new (G_OUTPUT_STREAM (file_stream));
+
+	if (!g_output_stream_printf (stream, NULL, NULL, error,
+				     "%s\n", RECORDING_HEADER))
+		return NULL;
+
+	recorder = g_object_new (TECLA_TYPE_KEY_RECORDER, NULL);
+	recorder->stream = g_steal_pointer (&stream);
+
+	return recorder;
+}
+
+static void
+record_event (TeclaKeyRecorder   *recorder,
+	      GtkEventController *controller,
+	      guint               keycode,
+	      gboolean            pressed)
+{
+	g_autoptr (GError) error = NULL;
+	guint32 time;
+
+	time = gtk_event_controller_get_current_event_time (controller);
+
+	if (!recorder->started) {
+		recorder->first_time = time;
+		recorder->started = TRUE;
+	}
+
+	if (!g_output_stream_printf (recorder->stream, NULL, NULL, &error,
+				     "%u\t%s\t%u\n",
+				     (guint32) (time - recorder->first_time),
+				     pressed ? "press" : "release",
+				     keycode))
+		g_warning ("Could not record key event: %s", error->message);
+}
+
+static gboolean
+key_pressed_cb (GtkEventControllerKey *controller,
+		guint                  keyval,
+		guint                  keycode,
+		GdkModifierType        state,
+		TeclaKeyRecorder      *recorder)
+{
+	record_event (recorder, GTK_EVENT_CONTROLLER (controller), keycode, TRUE);
+
+	return GDK_EVENT_PROPAGATE;
+}
+
+static void
+key_released_cb (GtkEventControllerKey *controller,
+		 guint                  keyval,
+		 guint                  keycode,
+		 GdkModifierType        state,
+		 TeclaKeyRecorder      *recorder)
+{
+	record_event (recorder, GTK_EVENT_CONTROLLER (controller), keycode, FALSE);
+}
+
+void
+tecla_key_recorder_watch (TeclaKeyRecorder *recorder,
+			  GtkWidget        *widget)
+{
+	GtkEventController *controller;
+
+	g_return_if_fail (TECLA_IS_KEY_RECORDER (recorder));
+	g_return_if_fail (GTK_IS_WIDGET (widget));
+
+	/* Capture phase, to see the same events the view handles */
+	controller = gtk_event_controller_key_new ();
+	gtk_event_controller_set_propagation_phase (controller, GTK_PHASE_CAPTURE);
+	g_signal_connect_object (controller, "key-pressed",
+				 G_CALLBACK (key_pressed_cb), recorder, 0);
+	g_signal_connect_object (controller, "key-released",
+				 G_CALLBACK (key_released_cb), recorder, 0);
+	gtk_widget_add_controller (widget, controller);
+}
+
+static gboolean
+parse_event (const gchar    *line,
+	     RecordedEvent  *event,
+	     GError        **error)
+{
+	g_auto (GStrv) fields = NULL;
+	guint64 time, keycode;
+
+	fields = g_strsplit (line, "\t", -1);
+	if (g_strv_length (fields) != 3) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+				     "Expected 3 fields");
+		return FALSE;
+	}
+
+	if (!g_ascii_string_to_unsigned (fields[0], 10, 0, G_MAXUINT32,
+					 &time, error) ||
+	    !g_ascii_string_to_unsigned (fields[2], 10, 0, G_MAXUINT32,
+					 &keycode, error))
+		return FALSE;
+
+	if (g_str_equal (fields[1], "press")) {
+		event->pressed = TRUE;
+	} else if (g_str_equal (fields[1], "release")) {
+		event->pressed = FALSE;
+	} else {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+			     "Unknown event type “%s”", fields[1]);
+		return FALSE;
+	}
+
+	event->time = time;
+	event->keycode = keycode;
+
+	return TRUE;
+}
+
+static GArray *
+load_events (const gchar  *path,
+	     GError      **error)
+{
+	g_autofree gchar *contents = NULL;
+	g_autoptr (GArray) events = NULL;
+	g_auto (GStrv) lines = NULL;
+	guint i;
+
+	if (!g_file_get_contents (path, &contents, NULL, error))
+		return NULL;
+
+	if (!g_str_has_prefix (contents, RECORDING_HEADER "\n")) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+			     "%s: Not a key event recording", path);
+		return NULL;
+	}
+
+	events = g_array_new (FALSE, FALSE, sizeof (RecordedEvent));
+	lines = g_strsplit (contents, "\n", -1);
+
+	for (i = 0; lines[i]; i++) {
+		g_autoptr (GError) line_error = NULL;
+		RecordedEvent event;
+
+		if (lines[i][0] == '\0' || lines[i][0] == '#')
+			continue;
+
+		if (!parse_event (lines[i], &event, &line_error)) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+				     "%s:%u: %s", path, i + 1, line_error->message);
+			return NULL;
+		}
+
+		g_array_append_val (events, event);
+	}
+
+	return g_steal_pointer (&events);
+}
+
+static void
+append_histogram_delta (GString             *report,
+			const gchar         *name,
+			TeclaStatsHistogram  histogram,
+			guint64              start_count,
+			guint64              start_sum)
+{
+	guint64 count, sum;
+
+	tecla_stats_get_histogram (histogram, &count, &sum);
+	g_string_append_printf (report, "%s\t%" G_GUINT64_FORMAT "\t%.2f ms\n",
+				name, count - start_count,
+				(sum - start_sum) / 1000.0);
+}
+
+gchar *
+tecla_replay_run (const gchar  *path,
+		  const gchar  *layout,
+		  gboolean      realtime,
+		  GError      **error)
+{
+	g_autoptr (GArray) events = NULL;
+	g_autoptr (TeclaModel) model = NULL;
+	g_autoptr (GtkWidget) view = NULL;
+	guint64 toggled_count, toggled_sum, level_count, level_sum;
+	gint64 start, snapshot_time = 0;
+	GString *report;
+	guint i;
+
+	g_return_val_if_fail (path != NULL, NULL);
+	g_return_val_if_fail (layout != NULL, NULL);
+
+	events = load_events (path, error);
+	if (!events)
+		return NULL;
+
+	/* Widgets need a display, even if nothing is shown */
+	if (!gtk_init_check ()) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_CONNECTED,
+				     "Could not open a display");
+		return NULL;
+	}
+
+	model = tecla_model_new_from_layout_name (layout);
+	if (!model) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+			     "Could not load layout “%s”", layout);
+		return NULL;
+	}
+
+	view = g_object_ref_sink (tecla_view_new ());
+	tecla_view_set_model (TECLA_VIEW (view), model);
+	gtk_widget_measure (view, GTK_ORIENTATION_HORIZONTAL, -1,
+			    NULL, NULL, NULL, NULL);
+	gtk_widget_allocate (view, VIEW_WIDTH, VIEW_HEIGHT, -1, NULL);
+
+	tecla_stats_get_histogram (TECLA_STATS_TOGGLED_KEYS_TIME,
+				   &toggled_count, &toggled_sum);
+	tecla_stats_get_histogram (TECLA_STATS_LEVEL_UPDATE_TIME,
+				   &level_count, &level_sum);
+
+	start = g_get_monotonic_time ();
+
+	for (i = 0; i < events->len; i++) {
+		RecordedEvent *event = &g_array_index (events, RecordedEvent, i);
+		GtkSnapshot *snapshot;
+		GskRenderNode *node;
+		gint64 snapshot_start;
+
+		if (realtime) {
+			gint64 delay;
+
+			delay = start + (gint64) event->time * 1000 -
+				g_get_monotonic_time ();
+			if (delay > 0)
+				g_usleep (delay);
+		}
+
+		tecla_view_feed_key (TECLA_VIEW (view), event->keycode,
+				     event->pressed);
+
+		/* Draw a frame per event, as the worst case */
+		snapshot_start = g_get_monotonic_time ();
+		snapshot = gtk_snapshot_new ();
+		tecla_view_snapshot_keys (TECLA_VIEW (view), snapshot);
+		node = gtk_snapshot_free_to_node (snapshot);
+		g_clear_pointer (&node, gsk_render_node_unref);
+		snapshot_time += g_get_monotonic_time () - snapshot_start;
+	}
+
+	report = g_string_new (NULL);
+	g_string_append_printf (report,
+				_("Replayed %u key events in %.2f ms\n"),
+				events->len,
+				(g_get_monotonic_time () - start) / 1000.0);
+	append_histogram_delta (report, "update_toggled_keys",
+				TECLA_STATS_TOGGLED_KEYS_TIME,
+				toggled_count, toggled_sum);
+	append_histogram_delta (report, "update_level",
+				TECLA_STATS_LEVEL_UPDATE_TIME,
+				level_count, level_sum);
+	g_string_append_printf (report, "snapshot\t%u\t%.2f ms\n",
+				events->len, snapshot_time / 1000.0);
+
+	return g_string_free (report, FALSE);
+}
@@ -0,0 +1,39 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <gtk/gtk.h>
+
+#pragma once
+
+#define TECLA_TYPE_KEY_RECORDER (tecla_key_recorder_get_type ())
+G_DECLARE_FINAL_TYPE (TeclaKeyRecorder, tecla_key_recorder,
+		      TECLA, KEY_RECORDER,
+		      GObject)
+
+TeclaKeyRecorder * tecla_key_recorder_new (GFile   *file,
+					   GError **error);
+
+void tecla_key_recorder_watch (TeclaKeyRecorder *recorder,
+			       GtkWidget        *widget);
+
+gchar * tecla_replay_run (const gchar  *path,
+			  const gchar  *layout,
+			  gboolean      realtime,
+			  GError      **error);
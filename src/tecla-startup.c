@@ -0,0 +1,152 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#define _GNU_SOURCE
+
+#include "tecla-startup.h"
+
+#include <glib/gi18n.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Only the first occurrence of each phase is kept, later windows
+ * and models are not part of startup.
+ */
+typedef struct
+{
+	gint64 begin;
+	gint64 end;
+} Phase;
+
+static Phase phases[TECLA_STARTUP_N_PHASES];
+
+static const gchar *phase_names[] = {
+	"main",
+	"adw-init",
+	"window-parse",
+	"construct-grid",
+	"model-compile",
+	"first-frame",
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (phase_names) == TECLA_STARTUP_N_PHASES);
+
+void
+tecla_startup_begin (TeclaStartupPhase phase)
+{
+	g_return_if_fail (phase < TECLA_STARTUP_N_PHASES);
+
+	if (phases[phase].begin == 0)
+		phases[phase].begin = g_get_monotonic_time ();
+}
+
+void
+tecla_startup_end (TeclaStartupPhase phase)
+{
+	g_return_if_fail (phase < TECLA_STARTUP_N_PHASES);
+
+	if (phases[phase].begin != 0 && phases[phase].end == 0)
+		phases[phase].end = g_get_monotonic_time ();
+}
+
+void
+tecla_startup_mark (TeclaStartupPhase phase,
+		    gint64            time)
+{
+	g_return_if_fail (phase < TECLA_STARTUP_N_PHASES);
+
+	if (phases[phase].begin == 0)
+		phases[phase].begin = phases[phase].end = time;
+}
+
+/* Process start in monotonic time, or 0 if unknown. This comes from
+ * the kernel in clock ticks, so it is only accurate to ~10ms.
+ */
+static gint64
+get_process_start_time (void)
+{
+	g_autofree gchar *contents = NULL;
+	g_auto (GStrv) fields = NULL;
+	const gchar *comm_end;
+	guint64 start_ticks;
+	struct timespec ts;
+	gint64 boot_time, start_time;
+	long ticks_per_sec;
+
+	if (!g_file_get_contents ("/proc/self/stat", &contents, NULL, NULL))
+		return 0;
+
+	/* The command name may contain spaces, skip past it */
+	comm_end = strrchr (contents, ')');
+	if (!comm_end || comm_end[1] != ' ')
+		return 0;
+
+	/* starttime is field 22, the 20th after the command name */
+	fields = g_strsplit (comm_end + 2, " ", 21);
+	if (g_strv_length (fields) < 20 ||
+	    !g_ascii_string_to_unsigned (fields[19], 10, 0, G_MAXUINT64,
+					 &start_ticks, NULL))
+		return 0;
+
+	ticks_per_sec = sysconf (_SC_CLK_TCK);
+	if (ticks_per_sec <= 0 ||
+	    clock_gettime (CLOCK_BOOTTIME, &ts) != 0)
+		return 0;
+
+	boot_time = (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+	start_time = start_ticks * G_USEC_PER_SEC / ticks_per_sec;
+
+	return g_get_monotonic_time () - (boot_time - start_time);
+}
+
+gchar *
+tecla_startup_format_report (void)
+{
+	GString *report;
+	gint64 origin;
+	guint i;
+
+	origin = get_process_start_time ();
+	if (origin == 0 || origin > phases[TECLA_STARTUP_MAIN].begin)
+		origin = phases[TECLA_STARTUP_MAIN].begin;
+
+	report = g_string_new (NULL);
+
+	if (phases[TECLA_STARTUP_FIRST_FRAME].begin != 0) {
+		g_string_append_printf (report,
+					_("First frame presented %.2f ms after process start\n"),
+					(phases[TECLA_STARTUP_FIRST_FRAME].begin - origin) / 1000.0);
+	}
+
+	g_string_append (report, "phase\tstart\tduration\n");
+
+	for (i = 0; i < TECLA_STARTUP_N_PHASES; i++) {
+		if (phases[i].begin == 0 || phases[i].end == 0)
+			continue;
+
+		g_string_append_printf (report, "%s\t%.2f ms\t%.2f ms\n",
+					phase_names[i],
+					(phases[i].begin - origin) / 1000.0,
+					(phases[i].end - phases[i].begin) / 1000.0);
+	}
+
+	return g_string_free (report, FALSE);
+}
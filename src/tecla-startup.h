@@ -0,0 +1,43 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <glib.h>
+
+#pragma once
+
+typedef enum
+{
+	TECLA_STARTUP_MAIN,
+	TECLA_STARTUP_ADW_INIT,
+	TECLA_STARTUP_WINDOW_PARSE,
+	TECLA_STARTUP_CONSTRUCT_GRID,
+	TECLA_STARTUP_MODEL_COMPILE,
+	TECLA_STARTUP_FIRST_FRAME,
+	TECLA_STARTUP_N_PHASES,
+} TeclaStartupPhase;
+
+void tecla_startup_begin (TeclaStartupPhase phase);
+
+void tecla_startup_end (TeclaStartupPhase phase);
+
+void tecla_startup_mark (TeclaStartupPhase phase,
+			 gint64            time);
+
+gchar * tecla_startup_format_report (void);
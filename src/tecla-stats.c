@@ -0,0 +1,144 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tecla-stats.h"
+
+/* Bucket 0 holds zeros, bucket N holds values in [2^(N-1), 2^N) */
+#define N_BUCKETS 24
+
+typedef struct
+{
+	guint64 count;
+	guint64 sum;
+	guint64 buckets[N_BUCKETS];
+} Histogram;
+
+static const gchar *counter_names[] = {
+	"keymap-compiles",
+	"keymap-skips",
+	"model-shared-hits",
+	"model-cache-hits",
+	"model-cache-misses",
+	"view-updates",
+	"view-snapshots",
+	"key-snapshots",
+	"popovers",
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (counter_names) == TECLA_STATS_N_COUNTERS);
+
+static const gchar *histogram_names[] = {
+	"view-update-usec",
+	"snapshots-per-frame",
+	"key-event-latency-usec",
+	"toggled-keys-usec",
+	"level-update-usec",
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (histogram_names) == TECLA_STATS_N_HISTOGRAMS);
+
+/* Counters may be bumped from model loading threads. They are 64-bit
+ * like the exported values, so they do not wrap in long sessions.
+ */
+static guint64 counters[TECLA_STATS_N_COUNTERS] = { 0, };
+
+/* Histograms are only recorded from the main thread */
+static Histogram histograms[TECLA_STATS_N_HISTOGRAMS] = { { 0, }, };
+
+void
+tecla_stats_increment (TeclaStatsCounter counter)
+{
+	g_return_if_fail (counter < TECLA_STATS_N_COUNTERS);
+
+	__atomic_fetch_add (&counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+guint64
+tecla_stats_get_counter (TeclaStatsCounter counter)
+{
+	g_return_val_if_fail (counter < TECLA_STATS_N_COUNTERS, 0);
+
+	return __atomic_load_n (&counters[counter], __ATOMIC_RELAXED);
+}
+
+void
+tecla_stats_record (TeclaStatsHistogram histogram,
+		    guint64             value)
+{
+	Histogram *h;
+	guint bucket;
+
+	g_return_if_fail (histogram < TECLA_STATS_N_HISTOGRAMS);
+
+	h = &histograms[histogram];
+	bucket = value > 0 ? MIN (g_bit_storage (value), N_BUCKETS - 1) : 0;
+
+	h->count++;
+	h->sum += value;
+	h->buckets[bucket]++;
+}
+
+void
+tecla_stats_get_histogram (TeclaStatsHistogram  histogram,
+			   guint64             *count,
+			   guint64             *sum)
+{
+	g_return_if_fail (histogram < TECLA_STATS_N_HISTOGRAMS);
+
+	*count = histograms[histogram].count;
+	*sum = histograms[histogram].sum;
+}
+
+GVariant *
+tecla_stats_get_counters (void)
+{
+	GVariantBuilder builder;
+	guint i;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+
+	for (i = 0; i < TECLA_STATS_N_COUNTERS; i++) {
+		g_variant_builder_add (&builder, "{st}", counter_names[i],
+				       tecla_stats_get_counter (i));
+	}
+
+	return g_variant_builder_end (&builder);
+}
+
+GVariant *
+tecla_stats_get_histograms (void)
+{
+	GVariantBuilder builder;
+	guint i;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(ttat)}"));
+
+	for (i = 0; i < TECLA_STATS_N_HISTOGRAMS; i++) {
+		Histogram *h = &histograms[i];
+
+		g_variant_builder_add (&builder, "{s(tt@at)}", histogram_names[i],
+				       h->count, h->sum,
+				       g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+								  h->buckets, N_BUCKETS,
+								  sizeof (guint64)));
+	}
+
+	return g_variant_builder_end (&builder);
+}
@@ -0,0 +1,62 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <glib.h>
+
+#pragma once
+
+typedef enum
+{
+	TECLA_STATS_KEYMAP_COMPILES,
+	TECLA_STATS_KEYMAP_SKIPS,
+	TECLA_STATS_MODEL_SHARED_HITS,
+	TECLA_STATS_MODEL_CACHE_HITS,
+	TECLA_STATS_MODEL_CACHE_MISSES,
+	TECLA_STATS_VIEW_UPDATES,
+	TECLA_STATS_VIEW_SNAPSHOTS,
+	TECLA_STATS_KEY_SNAPSHOTS,
+	TECLA_STATS_POPOVERS,
+	TECLA_STATS_N_COUNTERS,
+} TeclaStatsCounter;
+
+typedef enum
+{
+	TECLA_STATS_VIEW_UPDATE_TIME,
+	TECLA_STATS_SNAPSHOTS_PER_FRAME,
+	TECLA_STATS_KEY_EVENT_LATENCY,
+	TECLA_STATS_TOGGLED_KEYS_TIME,
+	TECLA_STATS_LEVEL_UPDATE_TIME,
+	TECLA_STATS_N_HISTOGRAMS,
+} TeclaStatsHistogram;
+
+void tecla_stats_increment (TeclaStatsCounter counter);
+
+guint64 tecla_stats_get_counter (TeclaStatsCounter counter);
+
+void tecla_stats_record (TeclaStatsHistogram histogram,
+			 guint64             value);
+
+void tecla_stats_get_histogram (TeclaStatsHistogram  histogram,
+				guint64             *count,
+				guint64             *sum);
+
+GVariant * tecla_stats_get_counters (void);
+
+GVariant * tecla_stats_get_histograms (void);
@@ -0,0 +1,618 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#define _GNU_SOURCE
+
+#include "tecla-thumbnail.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <math.h>
+#include <pango/pangocairo.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pc105.h"
+#include "tecla-model.h"
+
+/* Grid units per key, as in TeclaView */
+#define KEY_UNITS 4
+
+/* Bump whenever the rendering changes */
+#define CACHE_VERSION 2
+#define CACHE_MAX_SIZE (64 * 1024 * 1024)
+#define GEOMETRY_NAME "pc105"
+
+typedef struct
+{
+	gchar *path;
+	gint64 mtime;
+	goffset size;
+} CacheEntry;
+
+typedef struct
+{
+	gchar *key;
+	gchar *layout;
+	int width;
+	int height;
+	int scale;
+	GList *waiters;
+	/* Waiters that may still want the result */
+	guint n_interested;
+	GCancellable *cancellable;
+} RenderRequest;
+
+/* Requests being rendered, only accessed from the main thread */
+static GHashTable *pending = NULL;
+
+static void
+render_request_free (RenderRequest *request)
+{
+	g_free (request->key);
+	g_free (request->layout);
+	g_list_free (request->waiters);
+	g_object_unref (request->cancellable);
+	g_free (request);
+}
+
+void
+tecla_thumbnail_free (TeclaThumbnail *thumbnail)
+{
+	if (thumbnail->fd >= 0)
+		close (thumbnail->fd);
+	g_free (thumbnail);
+}
+
+static TeclaThumbnail *
+thumbnail_new (int width,
+	       int height,
+	       int scale)
+{
+	TeclaThumbnail *thumbnail;
+
+	thumbnail = g_new0 (TeclaThumbnail, 1);
+	thumbnail->fd = -1;
+	thumbnail->width = width * scale;
+	thumbnail->height = height * scale;
+	thumbnail->stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32,
+							   thumbnail->width);
+	thumbnail->format = GDK_MEMORY_DEFAULT;
+
+	return thumbnail;
+}
+
+static void
+rounded_rectangle (cairo_t *cr,
+		   double   x,
+		   double   y,
+		   double   width,
+		   double   height,
+		   double   radius)
+{
+	cairo_new_sub_path (cr);
+	cairo_arc (cr, x + width - radius, y + radius, radius, -G_PI_2, 0);
+	cairo_arc (cr, x + width - radius, y + height - radius, radius, 0, G_PI_2);
+	cairo_arc (cr, x + radius, y + height - radius, radius, G_PI_2, G_PI);
+	cairo_arc (cr, x + radius, y + radius, radius, G_PI, 3 * G_PI_2);
+	cairo_close_path (cr);
+}
+
+static void
+draw_layout (cairo_t    *cr,
+	     TeclaModel *model,
+	     double      width,
+	     double      height)
+{
+	g_autoptr (PangoLayout) layout = NULL;
+	PangoFontDescription *font;
+	double unit, gap, x_offset, y_offset;
+	int n_columns = 0, n_rows = 0;
+	gulong i, j;
+
+	for (i = 0; i < G_N_ELEMENTS (pc105_layout.rows); i++) {
+		int columns = 0;
+
+		for (j = 0; j < G_N_ELEMENTS (pc105_layout.rows[i].keys); j++) {
+			TeclaLayoutKey *key = &pc105_layout.rows[i].keys[j];
+
+			if (!key->name)
+				break;
+			columns += (int) (MAX (key->width, 1) * KEY_UNITS);
+		}
+
+		if (columns == 0)
+			break;
+
+		n_columns = MAX (n_columns, columns);
+		n_rows++;
+	}
+
+	/* Keys are square, so rows are as tall as a regular key is wide */
+	unit = MIN (width / n_columns, height / (n_rows * KEY_UNITS));
+	gap = unit / 2;
+	x_offset = (width - unit * n_columns) / 2;
+	y_offset = (height - unit * n_rows * KEY_UNITS) / 2;
+
+	layout = pango_cairo_create_layout (cr);
+	font = pango_font_description_from_string ("Noto Sans, Cantarell");
+	pango_font_description_set_absolute_size (font, unit * 1.5 * PANGO_SCALE);
+	pango_layout_set_font_description (layout, font);
+	pango_font_description_free (font);
+
+	cairo_set_line_width (cr, MAX (unit / 8, 0.5));
+
+	for (i = 0; i < (gulong) n_rows; i++) {
+		int anchor = 0;
+
+		for (j = 0; j < G_N_ELEMENTS (pc105_layout.rows[i].keys); j++) {
+			TeclaLayoutKey *key;
+			const gchar *label;
+			double x, y, key_width, key_height;
+			int top;
+
+			key = &pc105_layout.rows[i].keys[j];
+			if (!key->name)
+				break;
+
+			top = key->height >= 0 ? i : i + key->height + 1;
+			x = x_offset + anchor * unit + gap / 2;
+			y = y_offset + top * KEY_UNITS * unit + gap / 2;
+			key_width = (int) (MAX (key->width, 1) * KEY_UNITS) * unit - gap;
+			key_height = MAX (fabs (key->height), 1) * KEY_UNITS * unit - gap;
+			anchor += (int) (MAX (key->width, 1) * KEY_UNITS);
+
+			rounded_rectangle (cr, x, y, key_width, key_height, unit / 2);
+			cairo_set_source_rgb (cr, 0.98, 0.98, 0.98);
+			cairo_fill_preserve (cr);
+			cairo_set_source_rgb (cr, 0.75, 0.75, 0.75);
+			cairo_stroke (cr);
+
+			label = tecla_model_get_key_label (model, 0, key->name);
+			if (label && *label) {
+				PangoRectangle rect;
+				double ratio;
+
+				pango_layout_set_text (layout, label, -1);
+				pango_layout_get_pixel_extents (layout, NULL, &rect);
+				if (rect.width <= 0 || rect.height <= 0)
+					continue;
+
+				ratio = MIN (1.0, (key_width - gap) / rect.width);
+
+				cairo_save (cr);
+				cairo_translate (cr,
+						 x + (key_width - rect.width * ratio) / 2,
+						 y + (key_height - rect.height * ratio) / 2);
+				cairo_scale (cr, ratio, ratio);
+				cairo_move_to (cr, -rect.x, -rect.y);
+				cairo_set_source_rgb (cr, 0.2, 0.2, 0.2);
+				pango_cairo_show_layout (cr, layout);
+				cairo_restore (cr);
+			}
+		}
+	}
+}
+
+static TeclaThumbnail *
+render_thumbnail (TeclaModel  *model,
+		  int          width,
+		  int          height,
+		  int          scale,
+		  GError     **error)
+{
+	g_autoptr (TeclaThumbnail) thumbnail = NULL;
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	guchar *data;
+	gsize size;
+
+	thumbnail = thumbnail_new (width, height, scale);
+	size = (gsize) thumbnail->stride * thumbnail->height;
+
+	thumbnail->fd = memfd_create ("tecla-thumbnail",
+				      MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (thumbnail->fd < 0 || ftruncate (thumbnail->fd, size) < 0) {
+		int saved_errno = errno;
+
+		g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+			     "Could not allocate thumbnail: %s",
+			     g_strerror (saved_errno));
+		return NULL;
+	}
+
+	data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		     thumbnail->fd, 0);
+	if (data == MAP_FAILED) {
+		int saved_errno = errno;
+
+		g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+			     "Could not map thumbnail: %s",
+			     g_strerror (saved_errno));
+		return NULL;
+	}
+
+	surface = cairo_image_surface_create_for_data (data, CAIRO_FORMAT_ARGB32,
+						       thumbnail->width,
+						       thumbnail->height,
+						       thumbnail->stride);
+	cr = cairo_create (surface);
+	cairo_scale (cr, scale, scale);
+	draw_layout (cr, model, width, height);
+	cairo_destroy (cr);
+	cairo_surface_finish (surface);
+	cairo_surface_destroy (surface);
+	munmap (data, size);
+
+	/* Receivers may map the contents without fearing changes under them */
+	fcntl (thumbnail->fd, F_ADD_SEALS,
+	       F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+
+	return g_steal_pointer (&thumbnail);
+}
+
+static gchar *
+get_cache_path (RenderRequest *request)
+{
+	g_autofree gchar *key = NULL;
+	g_autofree gchar *filename = NULL;
+
+	/* The stamp changes along with the XKB data the layout is built from */
+	key = g_strdup_printf ("%d\n%s\n%s\n%dx%d@%d\n%" G_GUINT64_FORMAT,
+			       CACHE_VERSION, request->layout, GEOMETRY_NAME,
+			       request->width, request->height, request->scale,
+			       tecla_model_get_layout_stamp (request->layout));
+	filename = g_compute_checksum_for_string (G_CHECKSUM_SHA256, key, -1);
+
+	return g_build_filename (g_get_user_cache_dir (), "tecla", "thumbnails",
+				 filename, NULL);
+}
+
+static TeclaThumbnail *
+load_cached_thumbnail (const gchar   *path,
+		       RenderRequest *request)
+{
+	g_autoptr (TeclaThumbnail) thumbnail = NULL;
+	struct stat st;
+
+	thumbnail = thumbnail_new (request->width, request->height,
+				   request->scale);
+	thumbnail->fd = g_open (path, O_RDONLY | O_CLOEXEC, 0);
+	if (thumbnail->fd < 0)
+		return NULL;
+
+	if (fstat (thumbnail->fd, &st) < 0 ||
+	    st.st_size != (off_t) thumbnail->stride * thumbnail->height)
+		return NULL;
+
+	/* Eviction goes by modification time, bump it on every use */
+	g_utime (path, NULL);
+
+	return g_steal_pointer (&thumbnail);
+}
+
+static void
+cache_entry_clear (CacheEntry *entry)
+{
+	g_free (entry->path);
+}
+
+static int
+compare_cache_entries (const CacheEntry *a,
+		       const CacheEntry *b)
+{
+	return (a->mtime > b->mtime) - (a->mtime < b->mtime);
+}
+
+static void
+evict_cache (const gchar *path)
+{
+	g_autoptr (GDir) dir = NULL;
+	g_autoptr (GArray) entries = NULL;
+	const gchar *name;
+	goffset total = 0;
+	guint i;
+
+	dir = g_dir_open (path, 0, NULL);
+	if (!dir)
+		return;
+
+	entries = g_array_new (FALSE, FALSE, sizeof (CacheEntry));
+	g_array_set_clear_func (entries, (GDestroyNotify) cache_entry_clear);
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		CacheEntry entry;
+		GStatBuf st;
+
+		entry.path = g_build_filename (path, name, NULL);
+		if (g_stat (entry.path, &st) < 0 || !S_ISREG (st.st_mode)) {
+			g_free (entry.path);
+			continue;
+		}
+
+		entry.mtime = st.st_mtime;
+		entry.size = st.st_size;
+		total += entry.size;
+		g_array_append_val (entries, entry);
+	}
+
+	if (total <= CACHE_MAX_SIZE)
+		return;
+
+	g_array_sort (entries, (GCompareFunc) compare_cache_entries);
+
+	/* Other processes may be evicting at the same time, ignore failures */
+	for (i = 0; i < entries->len && total > CACHE_MAX_SIZE; i++) {
+		CacheEntry *entry = &g_array_index (entries, CacheEntry, i);
+
+		g_unlink (entry->path);
+		total -= entry->size;
+	}
+}
+
+static void
+save_cached_thumbnail (const gchar    *path,
+		       TeclaThumbnail *thumbnail)
+{
+	g_autofree gchar *dir = NULL;
+	g_autoptr (GError) error = NULL;
+	gpointer data;
+	gsize size;
+
+	dir = g_path_get_dirname (path);
+	if (g_mkdir_with_parents (dir, 0700) < 0) {
+		g_debug ("Could not create %s: %s", dir, g_strerror (errno));
+		return;
+	}
+
+	size = (gsize) thumbnail->stride * thumbnail->height;
+	data = mmap (NULL, size, PROT_READ, MAP_SHARED, thumbnail->fd, 0);
+	if (data == MAP_FAILED)
+		return;
+
+	/* Written atomically, so concurrent readers never see partial files */
+	if (!g_file_set_contents_full (path, data, size,
+				       G_FILE_SET_CONTENTS_CONSISTENT, 0600,
+				       &error))
+		g_debug ("Could not save thumbnail cache: %s", error->message);
+
+	munmap (data, size);
+	evict_cache (dir);
+}
+
+static void
+render_thread (GTask        *task,
+	       gpointer      source_object,
+	       gpointer      task_data,
+	       GCancellable *cancellable)
+{
+	RenderRequest *request = task_data;
+	g_autoptr (TeclaModel) model = NULL;
+	g_autofree gchar *cache_path = NULL;
+	TeclaThumbnail *thumbnail;
+	GError *error = NULL;
+
+	if (g_task_return_error_if_cancelled (task))
+		return;
+
+	cache_path = get_cache_path (request);
+	thumbnail = load_cached_thumbnail (cache_path, request);
+	if (thumbnail) {
+		g_task_return_pointer (task, thumbnail,
+				       (GDestroyNotify) tecla_thumbnail_free);
+		return;
+	}
+
+	model = tecla_model_new_from_layout_name (request->layout);
+	if (!model) {
+		g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+					 "Unknown layout “%s”", request->layout);
+		return;
+	}
+
+	/* The model is private to this thread, pin it to the first group
+	 * since that is the only one the cache key accounts for.
+	 */
+	tecla_model_set_group (model, 0);
+
+	if (g_task_return_error_if_cancelled (task))
+		return;
+
+	thumbnail = render_thumbnail (model, request->width, request->height,
+				      request->scale, &error);
+	if (!thumbnail) {
+		g_task_return_error (task, error);
+		return;
+	}
+
+	save_cached_thumbnail (cache_path, thumbnail);
+	g_task_return_pointer (task, thumbnail,
+			       (GDestroyNotify) tecla_thumbnail_free);
+}
+
+static void
+render_done_cb (GObject      *source,
+		GAsyncResult *result,
+		gpointer      user_data)
+{
+	RenderRequest *request = user_data;
+	g_autoptr (TeclaThumbnail) thumbnail = NULL;
+	g_autoptr (GError) error = NULL;
+	GList *l;
+
+	/* An abandoned request may have been replaced by a newer one */
+	if (g_hash_table_lookup (pending, request->key) == request)
+		g_hash_table_steal (pending, request->key);
+
+	thumbnail = g_task_propagate_pointer (G_TASK (result), &error);
+
+	/* Every waiter gets its own descriptor on the same memfd */
+	for (l = request->waiters; l; l = l->next) {
+		GTask *waiter = l->data;
+		TeclaThumbnail *copy;
+
+		g_cancellable_disconnect (g_task_get_cancellable (waiter),
+					  GPOINTER_TO_SIZE (g_task_get_task_data (waiter)));
+
+		if (!thumbnail) {
+			g_task_return_error (waiter, g_error_copy (error));
+			g_object_unref (waiter);
+			continue;
+		}
+
+		copy = g_memdup2 (thumbnail, sizeof (TeclaThumbnail));
+		copy->fd = fcntl (thumbnail->fd, F_DUPFD_CLOEXEC, 0);
+
+		if (copy->fd < 0) {
+			int saved_errno = errno;
+
+			g_free (copy);
+			g_task_return_new_error (waiter, G_IO_ERROR,
+						 g_io_error_from_errno (saved_errno),
+						 "Could not duplicate thumbnail: %s",
+						 g_strerror (saved_errno));
+		} else {
+			g_task_return_pointer (waiter, copy,
+					       (GDestroyNotify) tecla_thumbnail_free);
+		}
+
+		g_object_unref (waiter);
+	}
+
+	render_request_free (request);
+}
+
+static void
+waiter_cancelled_cb (GCancellable  *cancellable,
+		     RenderRequest *request)
+{
+	/* Nobody is left to use the result, stop rendering it */
+	if (--request->n_interested == 0)
+		g_cancellable_cancel (request->cancellable);
+}
+
+static void
+add_waiter (RenderRequest *request,
+	    GTask         *waiter)
+{
+	GCancellable *cancellable;
+	gulong handler_id = 0;
+
+	request->waiters = g_list_prepend (request->waiters, waiter);
+	request->n_interested++;
+
+	/* Runs right away if the waiter was already cancelled */
+	cancellable = g_task_get_cancellable (waiter);
+	if (cancellable) {
+		handler_id = g_cancellable_connect (cancellable,
+						    G_CALLBACK (waiter_cancelled_cb),
+						    request, NULL);
+	}
+
+	g_task_set_task_data (waiter, GSIZE_TO_POINTER (handler_id), NULL);
+}
+
+/* Must be called from the main thread, as must the cancellation of
+ * the given cancellable.
+ */
+void
+tecla_thumbnail_render_async (const gchar         *layout,
+			      int                  width,
+			      int                  height,
+			      int                  scale,
+			      int                  io_priority,
+			      GCancellable        *cancellable,
+			      GAsyncReadyCallback  callback,
+			      gpointer             user_data)
+{
+	g_autoptr (GTask) task = NULL;
+	g_autofree gchar *key = NULL;
+	RenderRequest *request;
+	GTask *waiter;
+
+	g_return_if_fail (layout != NULL);
+	g_return_if_fail (width > 0 && height > 0 && scale > 0);
+	g_return_if_fail (width * scale <= TECLA_THUMBNAIL_MAX_SIZE &&
+			  height * scale <= TECLA_THUMBNAIL_MAX_SIZE);
+
+	waiter = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (waiter, tecla_thumbnail_render_async);
+
+	if (!pending) {
+		pending = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+						 (GDestroyNotify) render_request_free);
+	}
+
+	/* Identical requests in flight share a single rendering */
+	key = g_strdup_printf ("%s:%dx%d@%d", layout, width, height, scale);
+	request = g_hash_table_lookup (pending, key);
+	if (request && !g_cancellable_is_cancelled (request->cancellable)) {
+		add_waiter (request, waiter);
+		return;
+	}
+
+	/* Its task still owns a request that is being cancelled */
+	if (request)
+		g_hash_table_steal (pending, key);
+
+	request = g_new0 (RenderRequest, 1);
+	request->key = g_steal_pointer (&key);
+	request->layout = g_strdup (layout);
+	request->width = width;
+	request->height = height;
+	request->scale = scale;
+	request->cancellable = g_cancellable_new ();
+	g_hash_table_insert (pending, request->key, request);
+	add_waiter (request, waiter);
+
+	task = g_task_new (NULL, request->cancellable, render_done_cb, request);
+	g_task_set_priority (task, io_priority);
+	g_task_set_task_data (task, request, NULL);
+	g_task_run_in_thread (task, render_thread);
+}
+
+TeclaThumbnail *
+tecla_thumbnail_render_finish (GAsyncResult  *result,
+			       GError       **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+GdkTexture *
+tecla_thumbnail_create_texture (TeclaThumbnail  *thumbnail,
+				GError         **error)
+{
+	g_autoptr (GMappedFile) mapped_file = NULL;
+	g_autoptr (GBytes) bytes = NULL;
+
+	mapped_file = g_mapped_file_new_from_fd (thumbnail->fd, FALSE, error);
+	if (!mapped_file)
+		return NULL;
+
+	bytes = g_mapped_file_get_bytes (mapped_file);
+
+	return gdk_memory_texture_new (thumbnail->width, thumbnail->height,
+				       thumbnail->format, bytes,
+				       thumbnail->stride);
+}
@@ -0,0 +1,56 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <gtk/gtk.h>
+
+#pragma once
+
+#define TECLA_THUMBNAIL_MAX_SIZE 4096
+
+typedef struct _TeclaThumbnail TeclaThumbnail;
+
+/* Pixel data in @format, behind a sealed memfd or a read-only cache file */
+struct _TeclaThumbnail
+{
+	int fd;
+	int width;
+	int height;
+	int stride;
+	GdkMemoryFormat format;
+};
+
+void tecla_thumbnail_render_async (const gchar         *layout,
+				   int                  width,
+				   int                  height,
+				   int                  scale,
+				   int                  io_priority,
+				   GCancellable        *cancellable,
+				   GAsyncReadyCallback  callback,
+				   gpointer             user_data);
+
+TeclaThumbnail * tecla_thumbnail_render_finish (GAsyncResult  *result,
+						GError       **error);
+
+GdkTexture * tecla_thumbnail_create_texture (TeclaThumbnail  *thumbnail,
+					     GError         **error);
+
+void tecla_thumbnail_free (TeclaThumbnail *thumbnail);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (TeclaThumbnail, tecla_thumbnail_free)
@@ -21,13 +21,39 @@
 #include "tecla-util.h"
 
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
+
+static const char *xkb_data_dirs[] = {
+  "rules",
+  "keycodes",
+  "types",
+  "compat",
+  "symbols",
+};
+
+static gboolean
+get_user_xkb_dir (char  *xdg,
+                  gsize  len)
+{
+  const char *env;
+
+  if ((env = g_getenv ("XDG_CONFIG_HOME")))
+    {
+      g_snprintf (xdg, len, "%s/xkb", env);
+    }
+  else if ((env = g_getenv ("HOME")))
+    {
+      g_snprintf (xdg, len, "%s/.config/xkb", env);
+    }
+
+  return env != NULL;
+}
 
 struct xkb_context *
 tecla_util_create_xkb_context (void)
 {
   struct xkb_context *ctx;
   char xdg[1024] = {0};
-  const char *env;
 
   /*
    * We can only append search paths in libxkbcommon, so we start with an
@@ -35,19 +61,181 @@ tecla_util_create_xkb_context (void)
    */
   ctx = xkb_context_new (XKB_CONTEXT_NO_DEFAULT_INCLUDES);
 
-  if ((env = g_getenv ("XDG_CONFIG_HOME")))
+  if (get_user_xkb_dir (xdg, sizeof xdg))
+    xkb_context_include_path_append (ctx, xdg);
+
+  xkb_context_include_path_append_default (ctx);
+
+  return ctx;
+}
+
+struct rxkb_context *
+tecla_util_create_rxkb_context (void)
+{
+  struct rxkb_context *ctx;
+  char xdg[1024] = {0};
+
+  /* Same search paths as tecla_util_create_xkb_context() */
+  ctx = rxkb_context_new (RXKB_CONTEXT_NO_DEFAULT_INCLUDES);
+
+  if (get_user_xkb_dir (xdg, sizeof xdg))
+    rxkb_context_include_path_append (ctx, xdg);
+
+  rxkb_context_include_path_append_default (ctx);
+
+  return ctx;
+}
+
+static guint64
+hash_bytes (guint64     hash,
+            const void *data,
+            gsize       len)
+{
+  const guchar *p = data;
+  gsize i;
+
+  /* FNV-1a */
+  for (i = 0; i < len; i++)
     {
-      g_snprintf (xdg, sizeof xdg, "%s/xkb", env);
+      hash ^= p[i];
+      hash *= G_GUINT64_CONSTANT (0x100000001b3);
     }
-  else if ((env = g_getenv ("HOME")))
+
+  return hash;
+}
+
+static guint64
+hash_file (guint64     hash,
+           const char *dir,
+           const char *subdir,
+           const char *name)
+{
+  g_autofree char *path = NULL;
+  gint64 values[2] = { 0, 0 };
+  GStatBuf st;
+
+  path = g_build_filename (dir, subdir, name, NULL);
+
+  if (g_stat (path, &st) == 0)
     {
-      g_snprintf (xdg, sizeof xdg, "%s/.config/xkb", env);
+      values[0] = st.st_mtime;
+      values[1] = st.st_size;
     }
 
-  if (env)
-    xkb_context_include_path_append (ctx, xdg);
+  return hash_bytes (hash, values, sizeof values);
+}
 
-  xkb_context_include_path_append_default (ctx);
+guint64
+tecla_util_get_xkb_stamp (struct xkb_context *ctx)
+{
+  guint64 hash = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+  unsigned int i, j;
 
-  return ctx;
+  /*
+   * Installing, removing or updating data files replaces them, which
+   * changes the mtime of their component directory. Only those and
+   * the ruleset are checked, so model loads stay a handful of stats.
+   */
+  for (i = 0; i < xkb_context_num_include_paths (ctx); i++)
+    {
+      const char *path = xkb_context_include_path_get (ctx, i);
+
+      hash = hash_bytes (hash, path, strlen (path) + 1);
+      hash = hash_file (hash, path, "rules", "evdev");
+
+      for (j = 0; j < G_N_ELEMENTS (xkb_data_dirs); j++)
+        hash = hash_file (hash, path, xkb_data_dirs[j], NULL);
+    }
+
+  return hash;
+}
+
+guint64
+tecla_util_get_registry_stamp (void)
+{
+  struct xkb_context *ctx;
+  guint64 hash = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+  unsigned int i;
+
+  /* The registry is read from the same include paths as keymaps */
+  ctx = tecla_util_create_xkb_context ();
+
+  for (i = 0; i < xkb_context_num_include_paths (ctx); i++)
+    {
+      const char *path = xkb_context_include_path_get (ctx, i);
+
+      hash = hash_bytes (hash, path, strlen (path) + 1);
+      hash = hash_file (hash, path, "rules", "evdev.xml");
+      hash = hash_file (hash, path, "rules", "evdev.extras.xml");
+    }
+
+  xkb_context_unref (ctx);
+
+  return hash;
+}
+
+static char *
+find_locale_compose_file (const char *localedir,
+                          const char *locale)
+{
+  g_autofree char *path = NULL;
+  g_autofree char *contents = NULL;
+  g_auto (GStrv) lines = NULL;
+  unsigned int i;
+
+  /* compose.dir maps locale names to Compose files, "file: locale" */
+  path = g_build_filename (localedir, "compose.dir", NULL);
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    return NULL;
+
+  lines = g_strsplit (contents, "\n", -1);
+
+  for (i = 0; lines[i]; i++)
+    {
+      char *sep = strchr (lines[i], ':');
+
+      if (lines[i][0] == '#' || !sep)
+        continue;
+
+      *sep = '\0';
+      if (g_strcmp0 (g_strstrip (sep + 1), locale) == 0)
+        return g_build_filename (localedir, g_strstrip (lines[i]), NULL);
+    }
+
+  return NULL;
+}
+
+guint64
+tecla_util_get_compose_stamp (const char *locale)
+{
+  g_autofree char *compose_file = NULL;
+  guint64 hash = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+  const char *env, *localedir;
+
+  /* Same files xkb_compose_table_new_from_locale() may pick */
+  hash = hash_bytes (hash, locale, strlen (locale) + 1);
+
+  if ((env = g_getenv ("XCOMPOSEFILE")))
+    {
+      hash = hash_bytes (hash, env, strlen (env) + 1);
+      hash = hash_file (hash, env, NULL, NULL);
+    }
+
+  hash = hash_file (hash, g_get_user_config_dir (), "XCompose", NULL);
+
+  if ((env = g_getenv ("HOME")))
+    hash = hash_file (hash, env, ".XCompose", NULL);
+
+  localedir = g_getenv ("XLOCALEDIR");
+  if (!localedir)
+    localedir = "/usr/share/X11/locale";
+
+  hash = hash_bytes (hash, localedir, strlen (localedir) + 1);
+  hash = hash_file (hash, localedir, "compose.dir", NULL);
+
+  compose_file = find_locale_compose_file (localedir, locale);
+  if (compose_file)
+    hash = hash_file (hash, compose_file, NULL, NULL);
+
+  return hash;
 }
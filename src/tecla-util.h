@@ -18,8 +18,18 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
  */
 
+#include <glib.h>
 #include <xkbcommon/xkbcommon.h>
+#include <xkbcommon/xkbregistry.h>
 
 #pragma once
 
 struct xkb_context * tecla_util_create_xkb_context (void);
+
+struct rxkb_context * tecla_util_create_rxkb_context (void);
+
+guint64 tecla_util_get_xkb_stamp (struct xkb_context *ctx);
+
+guint64 tecla_util_get_registry_stamp (void);
+
+guint64 tecla_util_get_compose_stamp (const char *locale);
@@ -18,6 +18,8 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
  */
 
+#include "config.h"
+
 #include <gtk/gtk.h>
 #include <xkbcommon/xkbcommon.h>
 
@@ -25,6 +27,9 @@
 
 #include "pc105.h"
 #include "tecla-key.h"
+#include "tecla-profiler.h"
+#include "tecla-startup.h"
+#include "tecla-stats.h"
 
 enum
 {
@@ -46,6 +51,11 @@ struct _TeclaView
 	GList *level5_keys;
 	guint toggled_levels;
 	int level;
+
+	GList *highlighted_keys;
+
+	/* Time of the last key press not yet followed by a frame */
+	gint64 key_event_time;
 };
 
 G_DEFINE_TYPE (TeclaView, tecla_view, GTK_TYPE_WIDGET)
@@ -64,6 +74,7 @@ static GParamSpec *props[N_PROPS];
 enum
 {
 	KEY_ACTIVATED,
+	KEY_PRESS_SHOWN,
 	N_SIGNALS,
 };
 
@@ -122,6 +133,7 @@ tecla_view_finalize (GObject *object)
 	g_clear_list (&view->level2_keys, NULL);
 	g_clear_list (&view->level3_keys, NULL);
 	g_clear_list (&view->level5_keys, NULL);
+	g_clear_list (&view->highlighted_keys, NULL);
 	gtk_widget_unparent (gtk_widget_get_first_child (GTK_WIDGET (view)));
 
 	G_OBJECT_CLASS (tecla_view_parent_class)->finalize (object);
@@ -281,6 +293,56 @@ construct_grid (TeclaView *view)
 	gtk_widget_set_layout_manager (GTK_WIDGET (view), gtk_bin_layout_new ());
 }
 
+static void
+tecla_view_snapshot (GtkWidget   *widget,
+		     GtkSnapshot *snapshot)
+{
+	guint64 key_snapshots;
+
+	/* Keys whose rendering did not change are not snapshot again */
+	key_snapshots = tecla_stats_get_counter (TECLA_STATS_KEY_SNAPSHOTS);
+
+	GTK_WIDGET_CLASS (tecla_view_parent_class)->snapshot (widget, snapshot);
+
+	tecla_stats_increment (TECLA_STATS_VIEW_SNAPSHOTS);
+	tecla_stats_record (TECLA_STATS_SNAPSHOTS_PER_FRAME,
+			    tecla_stats_get_counter (TECLA_STATS_KEY_SNAPSHOTS) -
+			    key_snapshots);
+}
+
+static void
+after_paint_cb (GdkFrameClock *frame_clock,
+		TeclaView     *view)
+{
+	if (view->key_event_time == 0)
+		return;
+
+	tecla_stats_record (TECLA_STATS_KEY_EVENT_LATENCY,
+			    g_get_monotonic_time () - view->key_event_time);
+	view->key_event_time = 0;
+}
+
+static void
+tecla_view_realize (GtkWidget *widget)
+{
+	GTK_WIDGET_CLASS (tecla_view_parent_class)->realize (widget);
+
+	g_signal_connect_object (gtk_widget_get_frame_clock (widget),
+				 "after-paint",
+				 G_CALLBACK (after_paint_cb),
+				 widget, 0);
+}
+
+static void
+tecla_view_unrealize (GtkWidget *widget)
+{
+	g_signal_handlers_disconnect_by_func (gtk_widget_get_frame_clock (widget),
+					      after_paint_cb, widget);
+	TECLA_VIEW (widget)->key_event_time = 0;
+
+	GTK_WIDGET_CLASS (tecla_view_parent_class)->unrealize (widget);
+}
+
 static void
 tecla_view_constructed (GObject *object)
 {
@@ -288,7 +350,9 @@ tecla_view_constructed (GObject *object)
 
 	G_OBJECT_CLASS (tecla_view_parent_class)->constructed (object);
 
+	tecla_startup_begin (TECLA_STARTUP_CONSTRUCT_GRID);
 	construct_grid (view);
+	tecla_startup_end (TECLA_STARTUP_CONSTRUCT_GRID);
 }
 
 static void
@@ -302,6 +366,10 @@ tecla_view_class_init (TeclaViewClass *klass)
 	object_class->finalize = tecla_view_finalize;
 	object_class->constructed = tecla_view_constructed;
 
+	widget_class->snapshot = tecla_view_snapshot;
+	widget_class->realize = tecla_view_realize;
+	widget_class->unrealize = tecla_view_unrealize;
+
 	signals[KEY_ACTIVATED] =
 		g_signal_new ("key-activated",
 			      G_OBJECT_CLASS_TYPE (object_class),
@@ -309,6 +377,13 @@ tecla_view_class_init (TeclaViewClass *klass)
 			      0, NULL, NULL, NULL,
 			      G_TYPE_NONE,
 			      2, G_TYPE_STRING, GTK_TYPE_WIDGET);
+	/* Emitted when a key press changed what the view shows */
+	signals[KEY_PRESS_SHOWN] =
+		g_signal_new ("key-press-shown",
+			      G_OBJECT_CLASS_TYPE (object_class),
+			      G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, NULL,
+			      G_TYPE_NONE, 0);
 
 	props[PROP_MODEL] =
 		g_param_spec_object ("model",
@@ -337,43 +412,45 @@ tecla_view_class_init (TeclaViewClass *klass)
 }
 
 static void
-key_pressed_cb (GtkEventControllerKey *controller,
-		guint                  keyval,
-		guint                  keycode,
-		GdkModifierType        modifiers,
-		TeclaView             *view)
+press_key (TeclaView *view,
+	   guint      keycode)
 {
 	const gchar *name;
 	GtkWidget *key;
+	gint64 start, end;
+	int level;
 
-	if (!view->model)
-		return;
-
+	/* Keys missing from the model, e.g. multimedia keys, have no name */
 	name = tecla_model_get_keycode_key (view->model, keycode);
-	key = g_hash_table_lookup (view->keys_by_name, name);
+	key = name ? g_hash_table_lookup (view->keys_by_name, name) : NULL;
 
 	if (key)
 		gtk_widget_set_state_flags (key, GTK_STATE_FLAG_ACTIVE, FALSE);
 
+	start = g_get_monotonic_time ();
 	update_toggled_keys (view, name);
+	end = g_get_monotonic_time ();
+	tecla_stats_record (TECLA_STATS_TOGGLED_KEYS_TIME, end - start);
+
+	level = view->level;
 	update_level (view);
+	tecla_stats_record (TECLA_STATS_LEVEL_UPDATE_TIME,
+			    g_get_monotonic_time () - end);
+
+	/* Keys off the layout, e.g. media keys, cause no damage */
+	if (key || level != view->level)
+		g_signal_emit (view, signals[KEY_PRESS_SHOWN], 0);
 }
 
 static void
-key_released_cb (GtkEventControllerKey *controller,
-		 guint                  keyval,
-		 guint                  keycode,
-		 GdkModifierType        modifiers,
-		 TeclaView             *view)
+release_key (TeclaView *view,
+	     guint      keycode)
 {
 	const gchar *name;
 	GtkWidget *key;
 
-	if (!view->model)
-		return;
-
 	name = tecla_model_get_keycode_key (view->model, keycode);
-	key = g_hash_table_lookup (view->keys_by_name, name);
+	key = name ? g_hash_table_lookup (view->keys_by_name, name) : NULL;
 
 	if (key)
 		gtk_widget_unset_state_flags (key, GTK_STATE_FLAG_ACTIVE);
@@ -381,6 +458,35 @@ key_released_cb (GtkEventControllerKey *controller,
 	g_signal_emit (view, signals[KEY_ACTIVATED], 0, name, key);
 }
 
+static void
+key_pressed_cb (GtkEventControllerKey *controller,
+		guint                  keyval,
+		guint                  keycode,
+		GdkModifierType        modifiers,
+		TeclaView             *view)
+{
+	if (!view->model)
+		return;
+
+	if (view->key_event_time == 0)
+		view->key_event_time = g_get_monotonic_time ();
+
+	press_key (view, keycode);
+}
+
+static void
+key_released_cb (GtkEventControllerKey *controller,
+		 guint                  keyval,
+		 guint                  keycode,
+		 GdkModifierType        modifiers,
+		 TeclaView             *view)
+{
+	if (!view->model)
+		return;
+
+	release_key (view, keycode);
+}
+
 static void
 tecla_view_init (TeclaView *view)
 {
@@ -405,7 +511,7 @@ update_from_model_foreach (const gchar *name,
 			   TeclaView   *view)
 {
 	xkb_keycode_t keycode;
-	g_autofree gchar *action = NULL;
+	const gchar *action = NULL;
 	guint keyval;
 
 	keycode = tecla_model_get_key_keycode (view->model, name);
@@ -415,27 +521,27 @@ update_from_model_foreach (const gchar *name,
 		return;
 
 	// For modifier keys, always display the symbol for level 0
-	if (keyval == GDK_KEY_Shift_L || keyval == GDK_KEY_Shift_R) {
+	switch (tecla_model_get_key_modifier (view->model, keycode)) {
+	case TECLA_MODEL_KEY_LEVEL2:
 		if (!g_list_find_custom (view->level2_keys, name, (GCompareFunc) g_strcmp0))
 			view->level2_keys = g_list_prepend (view->level2_keys, (gpointer) name);
-		action = g_strdup ("⬆");
-	}
-
-	if (keyval == GDK_KEY_ISO_Level3_Shift) {
+		action = "⬆";
+		break;
+	case TECLA_MODEL_KEY_LEVEL3:
 		if (!g_list_find_custom (view->level3_keys, name, (GCompareFunc) g_strcmp0))
 			view->level3_keys = g_list_prepend (view->level3_keys, (gpointer) name);
-		action = g_strdup ("⎇");
-	}
-
-	if (keyval == GDK_KEY_ISO_Level5_Shift || keyval == GDK_KEY_ISO_Level5_Latch) {
+		action = "⎇";
+		break;
+	case TECLA_MODEL_KEY_LEVEL5:
 		if (!g_list_find_custom (view->level5_keys, name, (GCompareFunc) g_strcmp0))
 			view->level5_keys = g_list_prepend (view->level5_keys, (gpointer) name);
-		action = g_strdup ("⎇5");
-	}
-
-	if (!action)
+		action = "⎇5";
+		break;
+	default:
 		// For all other keys, use the symbol for the current level
 		action = tecla_model_get_key_label (view->model, view->level, name);
+		break;
+	}
 
 	tecla_key_set_label (key, action);
 }
@@ -443,9 +549,22 @@ update_from_model_foreach (const gchar *name,
 static void
 update_view (TeclaView *view)
 {
+	gint64 start;
+
+	TECLA_PROFILER_BEGIN_MARK;
+
+	start = g_get_monotonic_time ();
+
 	g_hash_table_foreach (view->keys_by_name,
 			      (GHFunc) update_from_model_foreach,
 			      view);
+
+	tecla_stats_increment (TECLA_STATS_VIEW_UPDATES);
+	tecla_stats_record (TECLA_STATS_VIEW_UPDATE_TIME,
+			    g_get_monotonic_time () - start);
+
+	TECLA_PROFILER_END_MARK ("Update view", "%u keys",
+				 g_hash_table_size (view->keys_by_name));
 }
 
 GtkWidget *
@@ -454,10 +573,44 @@ tecla_view_new (void)
 	return g_object_new (TECLA_TYPE_VIEW, NULL);
 }
 
+static void
+clear_highlight (TeclaView *view)
+{
+	GList *l;
+
+	for (l = view->highlighted_keys; l; l = l->next)
+		gtk_widget_remove_css_class (l->data, "highlighted");
+
+	g_clear_list (&view->highlighted_keys, NULL);
+}
+
+static void
+highlight_key (TeclaView     *view,
+	       xkb_keycode_t  keycode)
+{
+	const gchar *name;
+	GtkWidget *key;
+
+	name = tecla_model_get_keycode_key (view->model, keycode);
+	if (!name)
+		return;
+
+	key = g_hash_table_lookup (view->keys_by_name, name);
+	if (!key)
+		return;
+
+	gtk_widget_add_css_class (key, "highlighted");
+	view->highlighted_keys = g_list_prepend (view->highlighted_keys, key);
+}
+
 static void
 model_changed_cb (TeclaModel *model,
 		  TeclaView  *view)
 {
+	TECLA_PROFILER_BEGIN_MARK;
+
+	clear_highlight (view);
+
 	view->toggled_levels = 0;
 	view->level = 0;
 	update_toggled_key_list (view, view->level2_keys, LEVEL2_PRESSED);
@@ -473,6 +626,9 @@ model_changed_cb (TeclaModel *model,
 
 	g_object_notify (G_OBJECT (view), "num-levels");
 	g_object_notify (G_OBJECT (view), "level");
+
+	TECLA_PROFILER_END_MARK ("Model changed", "%s",
+				 tecla_model_get_name (model));
 }
 
 void
@@ -515,6 +671,22 @@ tecla_view_set_current_level (TeclaView *view,
 	update_level (view);
 }
 
+void
+tecla_view_feed_key (TeclaView *view,
+		     guint      keycode,
+		     gboolean   pressed)
+{
+	g_return_if_fail (TECLA_IS_VIEW (view));
+
+	if (!view->model)
+		return;
+
+	if (pressed)
+		press_key (view, keycode);
+	else
+		release_key (view, keycode);
+}
+
 int
 tecla_view_get_num_levels (TeclaView *view)
 {
@@ -527,3 +699,75 @@ tecla_view_get_num_levels (TeclaView *view)
 	else
 		return 1;
 }
+
+static void
+snapshot_keys (GtkWidget   *widget,
+	       GtkWidget   *view,
+	       GtkSnapshot *snapshot)
+{
+	GtkWidget *child;
+
+	for (child = gtk_widget_get_first_child (widget);
+	     child;
+	     child = gtk_widget_get_next_sibling (child)) {
+		graphene_rect_t bounds;
+
+		if (!gtk_widget_get_visible (child))
+			continue;
+
+		if (!TECLA_IS_KEY (child)) {
+			snapshot_keys (child, view, snapshot);
+			continue;
+		}
+
+		if (!gtk_widget_compute_bounds (child, view, &bounds))
+			continue;
+
+		gtk_snapshot_save (snapshot);
+		gtk_snapshot_translate (snapshot, &bounds.origin);
+		GTK_WIDGET_GET_CLASS (child)->snapshot (child, snapshot);
+		gtk_snapshot_restore (snapshot);
+	}
+}
+
+/* Unmapped widgets do not draw their children, so this snapshots
+ * the keys directly at their allocated positions. Only meant for
+ * offscreen rendering, CSS backgrounds and borders are not drawn.
+ */
+void
+tecla_view_snapshot_keys (TeclaView   *view,
+			  GtkSnapshot *snapshot)
+{
+	g_return_if_fail (TECLA_IS_VIEW (view));
+	g_return_if_fail (GTK_IS_SNAPSHOT (snapshot));
+
+	snapshot_keys (GTK_WIDGET (view), GTK_WIDGET (view), snapshot);
+}
+
+gboolean
+tecla_view_highlight_char (TeclaView *view,
+			   gunichar   ch)
+{
+	TeclaModelKeyPosition position;
+
+	clear_highlight (view);
+
+	if (!view->model || ch == 0 ||
+	    !tecla_model_find_char (view->model, ch, &position))
+		return FALSE;
+
+	/* Switching groups resets the view, so it goes first */
+	if (position.group != tecla_model_get_group (view->model))
+		tecla_model_set_group (view->model, position.group);
+
+	if (position.dead_keycode) {
+		tecla_view_set_current_level (view, position.dead_level);
+		highlight_key (view, position.dead_keycode);
+	} else {
+		tecla_view_set_current_level (view, position.level);
+	}
+
+	highlight_key (view, position.keycode);
+
+	return TRUE;
+}
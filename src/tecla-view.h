@@ -40,3 +40,13 @@ void tecla_view_set_current_level (TeclaView *view,
 				   int        level);
 
 int tecla_view_get_num_levels (TeclaView *view);
+
+void tecla_view_feed_key (TeclaView *view,
+			  guint      keycode,
+			  gboolean   pressed);
+
+void tecla_view_snapshot_keys (TeclaView   *view,
+			       GtkSnapshot *snapshot);
+
+gboolean tecla_view_highlight_char (TeclaView *view,
+				    gunichar   ch);